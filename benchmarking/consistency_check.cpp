@@ -0,0 +1,407 @@
+// g++ benchmarking/consistency_check.cpp -o consistency_check -std=c++17 -O2 -pthread -I./include
+// Checks every shortest-path engine, the minimum-exchange route, /route in
+// time and cost modes, /matrix with and without line changes, and /reachable
+// by distance and by time against a plain reference search over the CSV rows
+// themselves. Networks are random and include zero-length edges, edges that
+// round to 0 m, parallel edges on the same and on different lines, and
+// stations that cannot reach each other. Most stations get coordinates, so A*
+// runs with a real heuristic; the rest have none. Each network is checked
+// with all indexes built, with the search fallbacks, and with plain searches
+// only.
+// Usage: ./consistency_check [networks]
+#define METRO_NO_MAIN
+#include "../main.cpp"
+
+struct Row {
+    int from;
+    int to;
+    int line;
+    int metres;
+};
+
+uint64_t rngState = 11;
+
+int randomBelow(int bound) {
+    rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (rngState >> 33) % bound;
+}
+
+// Lines are random walks over the stations. A fifth of the hops are 0 m or
+// 0.0004 km, and some hops are repeated, with another length, on the same
+// line or on another one.
+vector<Row> randomNetwork(int stationCount, int lineCount, vector<string>& text) {
+    vector<Row> rows;
+    text.clear();
+    auto add = [&](int from, int to, int line, int tenthsOfMetre) {
+        char km[32];
+        snprintf(km, sizeof(km), "%.4f", tenthsOfMetre / 10000.0);
+        rows.push_back({from, to, line, toMetres(atof(km))});
+        text.push_back("S" + to_string(from) + ",S" + to_string(to) + ",L" + to_string(line) + "," + km);
+    };
+    auto length = [&]() {
+        int kind = randomBelow(10);
+        return kind == 0 ? 0 : kind == 1 ? 4 : 10 * (1 + randomBelow(3000));
+    };
+
+    for (int line = 0; line < lineCount; line++) {
+        int at = randomBelow(stationCount);
+        int stops = 2 + randomBelow(stationCount / 2);
+        for (int i = 0; i < stops; i++) {
+            int next = randomBelow(stationCount);
+            if (next == at) continue;
+            add(at, next, line, length());
+            if (randomBelow(8) == 0) add(at, next, randomBelow(3) == 0 ? randomBelow(lineCount) : line, length());
+            at = next;
+        }
+    }
+    return rows;
+}
+
+// Dijkstra over the rows: metres between stations
+vector<long long> referenceDistances(const vector<Row>& rows, int stationCount, int source) {
+    vector<vector<pair<int,int>>> adjacent(stationCount);
+    for (const Row& r : rows) {
+        adjacent[r.from].push_back({r.to, r.metres});
+        adjacent[r.to].push_back({r.from, r.metres});
+    }
+    vector<long long> dist(stationCount, LLONG_MAX);
+    priority_queue<pair<long long,int>, vector<pair<long long,int>>, greater<>> pq;
+    dist[source] = 0;
+    pq.push({0, source});
+    while (!pq.empty()) {
+        auto [d, u] = pq.top();
+        pq.pop();
+        if (d != dist[u]) continue;
+        for (auto [v, w] : adjacent[u]) {
+            if (d + w < dist[v]) {
+                dist[v] = d + w;
+                pq.push({dist[v], v});
+            }
+        }
+    }
+    return dist;
+}
+
+// Dijkstra over (station, line) pairs ordered by (line changes, metres).
+// Boarding any line at the source is free.
+vector<pair<long long,long long>> referenceExchanges(const vector<Row>& rows, int stationCount, int lineCount,
+                                                     int source) {
+    typedef pair<long long,long long> Cost;  // changes, metres
+    const Cost unreached = {LLONG_MAX, LLONG_MAX};
+    vector<vector<array<int,3>>> adjacent(stationCount);  // to, line, metres
+    for (const Row& r : rows) {
+        adjacent[r.from].push_back({r.to, r.line, r.metres});
+        adjacent[r.to].push_back({r.from, r.line, r.metres});
+    }
+
+    vector<Cost> best((size_t)stationCount * lineCount, unreached);
+    priority_queue<pair<Cost,int>, vector<pair<Cost,int>>, greater<>> pq;
+    for (int line = 0; line < lineCount; line++) {
+        best[(size_t)source * lineCount + line] = {0, 0};
+        pq.push({{0, 0}, source * lineCount + line});
+    }
+    while (!pq.empty()) {
+        auto [cost, state] = pq.top();
+        pq.pop();
+        if (cost != best[state]) continue;
+        int u = state / lineCount, line = state % lineCount;
+        for (auto [v, next, w] : adjacent[u]) {
+            Cost offer = {cost.first + (next != line), cost.second + w};
+            if (offer < best[(size_t)v * lineCount + next]) {
+                best[(size_t)v * lineCount + next] = offer;
+                pq.push({offer, v * lineCount + next});
+            }
+        }
+    }
+
+    vector<Cost> result(stationCount, unreached);
+    for (int u = 0; u < stationCount; u++) {
+        for (int line = 0; line < lineCount; line++) result[u] = min(result[u], best[(size_t)u * lineCount + line]);
+    }
+    result[source] = {0, 0};
+    return result;
+}
+
+// Dijkstra over (station, line) pairs ordered by (cost, line changes), where
+// step(metres, change) is the cost of one hop. Boarding any line at the
+// source is free.
+template <typename Step>
+vector<pair<long long,long long>> referenceStates(const vector<Row>& rows, int stationCount, int lineCount,
+                                                  int source, Step step) {
+    typedef pair<long long,long long> Cost;  // cost, changes
+    const Cost unreached = {LLONG_MAX, LLONG_MAX};
+    vector<vector<array<int,3>>> adjacent(stationCount);  // to, line, metres
+    for (const Row& r : rows) {
+        adjacent[r.from].push_back({r.to, r.line, r.metres});
+        adjacent[r.to].push_back({r.from, r.line, r.metres});
+    }
+
+    vector<Cost> best((size_t)stationCount * lineCount, unreached);
+    priority_queue<pair<Cost,int>, vector<pair<Cost,int>>, greater<>> pq;
+    for (int line = 0; line < lineCount; line++) {
+        best[(size_t)source * lineCount + line] = {0, 0};
+        pq.push({{0, 0}, source * lineCount + line});
+    }
+    while (!pq.empty()) {
+        auto [cost, state] = pq.top();
+        pq.pop();
+        if (cost != best[state]) continue;
+        int u = state / lineCount, line = state % lineCount;
+        for (auto [v, next, w] : adjacent[u]) {
+            Cost offer = {cost.first + step(w, next != line), cost.second + (next != line)};
+            if (offer < best[(size_t)v * lineCount + next]) {
+                best[(size_t)v * lineCount + next] = offer;
+                pq.push({offer, v * lineCount + next});
+            }
+        }
+    }
+
+    vector<Cost> result(stationCount, unreached);
+    for (int u = 0; u < stationCount; u++) {
+        for (int line = 0; line < lineCount; line++) result[u] = min(result[u], best[(size_t)u * lineCount + line]);
+    }
+    return result;
+}
+
+long long travelSeconds(int metres, bool change) {
+    return (long long)metres * 3600 / (trainSpeedKmh * metresPerKm) + dwellSeconds + (change ? transferSeconds : 0);
+}
+
+long long generalisedCost(int metres, bool change) {
+    return metres + (change ? exchangePenaltyMetres : 0);
+}
+
+// Shortest edge from a to b, on line (any line for -1), or -1 if none
+long long edgeMetres(const vector<Row>& rows, int a, int b, int line) {
+    long long best = -1;
+    for (const Row& r : rows) {
+        if (!((r.from == a && r.to == b) || (r.from == b && r.to == a))) continue;
+        if (line != -1 && r.line != line) continue;
+        if (best == -1 || r.metres < best) best = r.metres;
+    }
+    return best;
+}
+
+// Coordinates for most stations, in a box about 2 km across. Stations joined
+// by a 0 m edge share a point, since a positive chord over 0 m of track would
+// rule A* out; about a quarter of the stations are left without a position.
+vector<string> randomCoordinates(const vector<Row>& rows, int stationCount) {
+    vector<int> group(stationCount);
+    iota(group.begin(), group.end(), 0);
+    function<int(int)> find = [&](int u) { return group[u] == u ? u : group[u] = find(group[u]); };
+    for (const Row& r : rows) {
+        if (r.metres == 0) group[find(r.from)] = find(r.to);
+    }
+
+    vector<pair<double,double>> point(stationCount);
+    for (int u = 0; u < stationCount; u++) point[u] = {77 + randomBelow(20000) / 1e6, 28.6 + randomBelow(20000) / 1e6};
+
+    vector<string> text;
+    for (int u = 0; u < stationCount; u++) {
+        if (randomBelow(4) == 0) continue;
+        char line[64];
+        snprintf(line, sizeof(line), "S%d,%.6f,%.6f", u, point[find(u)].first, point[find(u)].second);
+        text.push_back(line);
+    }
+    return text;
+}
+
+int failures = 0;
+
+void fail(const string& what) {
+    if (failures++ < 20) cout << what << endl;
+}
+
+int main(int argc, char* argv[]) {
+    int networks = argc > 1 ? atoi(argv[1]) : 60;
+    string filename = (filesystem::temp_directory_path() / "metro_consistency_check.csv").string();
+    string coordinatesFile = (filesystem::temp_directory_path() / "metro_consistency_coordinates.csv").string();
+    int withHeuristic = 0;
+
+    for (int network = 0; network < networks; network++) {
+        int stationCount = 4 + randomBelow(40), lineCount = 1 + randomBelow(6);
+        vector<string> text;
+        vector<Row> rows = randomNetwork(stationCount, lineCount, text);
+        {
+            ofstream out(filename, ios::trunc);
+            out << "Station1,Station2,Color,distance\n";
+            for (const string& line : text) out << line << "\n";
+        }
+        {
+            ofstream out(coordinatesFile, ios::trunc);
+            out << "Station,X,Y\n";
+            for (const string& line : randomCoordinates(rows, stationCount)) out << line << "\n";
+        }
+
+        for (int config = 0; config < 3; config++) {
+            // 0: every index; 1: search fallbacks; 2: plain searches only
+            routingTableMaxBytes = config == 0 ? 2 << 20 : 0;
+            transferPatternMaxStations = config == 0 ? 3000 : 0;
+            hubLabelMaxStations = config == 0 ? 20000 : 0;
+            useContractionHierarchy = config < 2;
+            useChainOverlay = config < 2;
+            useLineGraph = config == 1;
+            altLandmarkCount = config < 2 ? 4 : 0;
+
+            MetroGraph metro;
+            cout.setstate(ios::failbit);  // build logs
+            metro.loadFromFile(filename);
+            metro.buildIntegerGraph();
+            metro.loadCoordinates(coordinatesFile);
+            cout.clear();
+            if (config == 0 && metro.geoScale > 0) withHeuristic++;
+
+            // Row station IDs by name; stations on no row are not in the graph
+            vector<int> id(stationCount);
+            for (int s = 0; s < stationCount; s++) id[s] = metro.stations.find("S" + to_string(s));
+            string where = "network " + to_string(network) + " config " + to_string(config) + ": ";
+
+            for (int s = 0; s < stationCount; s++) {
+                if (id[s] == -1) continue;
+                vector<long long> dist = referenceDistances(rows, stationCount, s);
+                auto exchanges = referenceExchanges(rows, stationCount, lineCount, s);
+                auto times = referenceStates(rows, stationCount, lineCount, s, travelSeconds);
+                auto costs = referenceStates(rows, stationCount, lineCount, s, generalisedCost);
+                auto lengths = referenceStates(rows, stationCount, lineCount, s, [](int metres, bool) { return metres; });
+
+                for (int t = 0; t < stationCount; t++) {
+                    if (id[t] == -1) continue;
+                    string pair = where + "S" + to_string(s) + " -> S" + to_string(t);
+
+                    for (int engine = EngineAuto; engine < EngineCount; engine++) {
+                        json result = metro.findShortestPathOptimized("S" + to_string(s), "S" + to_string(t),
+                                                                      (ShortestPathEngine)engine);
+                        if (dist[t] == LLONG_MAX) {
+                            if (!result.contains("error")) fail(pair + " " + engineNames[engine] + ": expected no path");
+                            continue;
+                        }
+                        if (result.contains("error") || toMetres(result["total_distance"].get<double>()) != dist[t]) {
+                            fail(pair + " " + engineNames[engine] + ": wrong distance " + result.dump());
+                            continue;
+                        }
+
+                        // The path must be made of edges that add up to the distance
+                        vector<string> path = result["path"];
+                        long long metres = 0;
+                        for (size_t i = 0; i + 1 < path.size() && metres != -1; i++) {
+                            long long w = edgeMetres(rows, stoi(path[i].substr(1)), stoi(path[i + 1].substr(1)), -1);
+                            metres = w == -1 ? -1 : metres + w;
+                        }
+                        if (path.front() != "S" + to_string(s) || path.back() != "S" + to_string(t) || metres != dist[t])
+                            fail(pair + " " + engineNames[engine] + ": path does not match " + result.dump());
+                    }
+
+                    vector<int> route, hopLines;
+                    auto [changes, metres] = metro.minimumExchangeRoute(id[s], id[t], route, hopLines);
+                    if (exchanges[t].first == LLONG_MAX) {
+                        if (changes != INT_MAX) fail(pair + ": expected no exchange route");
+                        continue;
+                    }
+                    if (changes != exchanges[t].first || metres != exchanges[t].second) {
+                        fail(pair + ": exchange route " + to_string(changes) + " changes, " + to_string(metres) + " m");
+                        continue;
+                    }
+
+                    // Each hop must ride its line, and the hops must add up
+                    long long walked = 0;
+                    int switches = 0;
+                    for (size_t i = 0; i + 1 < route.size() && walked != -1; i++) {
+                        int a = stoi(string(metro.stations.name(route[i])).substr(1));
+                        int b = stoi(string(metro.stations.name(route[i + 1])).substr(1));
+                        long long w = edgeMetres(rows, a, b, stoi(string(metro.lines.name(hopLines[i])).substr(1)));
+                        walked = w == -1 ? -1 : walked + w;
+                        if (i > 0 && hopLines[i] != hopLines[i - 1]) switches++;
+                    }
+                    if (route.front() != id[s] || route.back() != id[t] || walked != metres || switches != changes)
+                        fail(pair + ": exchange route does not match its totals");
+
+                    // /route by time and by generalised cost: the cost must be the
+                    // cheapest, and the hops must add up to it and to the changes
+                    for (RouteMode mode : {ModeTime, ModeCost}) {
+                        auto step = mode == ModeTime ? travelSeconds : generalisedCost;
+                        long long want = (mode == ModeTime ? times : costs)[t].first;
+                        string what = pair + " " + modeNames[mode];
+
+                        json result = metro.findRouteOptimized("S" + to_string(s), "S" + to_string(t), mode);
+                        if (want == LLONG_MAX) {
+                            if (!result.contains("error")) fail(what + ": expected no route");
+                            continue;
+                        }
+                        long long got = result.contains("error") ? -1
+                                      : mode == ModeTime ? llround(result["total_time_minutes"].get<double>() * 60)
+                                                         : toMetres(result["generalised_cost"].get<double>());
+                        if (got != want) {
+                            fail(what + ": wrong cost " + result.dump());
+                            continue;
+                        }
+
+                        int routeChanges = 0;
+                        int cost = mode == ModeTime
+                                       ? metro.stateRoute(MetroGraph::TimePolicy{{metro}}, id[s], id[t], route, hopLines, routeChanges)
+                                       : metro.stateRoute(MetroGraph::GeneralisedCostPolicy{{metro}}, id[s], id[t], route,
+                                                          hopLines, routeChanges);
+                        long long total = 0;
+                        switches = 0;
+                        for (size_t i = 0; i + 1 < route.size() && total != -1; i++) {
+                            int a = stoi(string(metro.stations.name(route[i])).substr(1));
+                            int b = stoi(string(metro.stations.name(route[i + 1])).substr(1));
+                            long long w = edgeMetres(rows, a, b, stoi(string(metro.lines.name(hopLines[i])).substr(1)));
+                            bool change = i > 0 && hopLines[i] != hopLines[i - 1];
+                            total = w == -1 ? -1 : total + step(w, change);
+                            switches += change;
+                        }
+                        if (cost != want || total != want || switches != routeChanges ||
+                            result["total_line_changes"] != routeChanges)
+                            fail(what + ": route does not match its totals");
+                    }
+                }
+
+                // One row of /matrix, alone and with line changes (checked
+                // against both searches, which may share their tables)
+                vector<int> sources = {id[s]}, targets, matrix, changeMatrix;
+                for (int t = 0; t < stationCount; t++) if (id[t] != -1) targets.push_back(id[t]);
+                for (bool withChanges : {false, true}) {
+                    metro.distanceMatrix(sources, targets, matrix, withChanges ? &changeMatrix : nullptr);
+                    for (size_t j = 0; j < targets.size(); j++) {
+                        int t = stoi(string(metro.stations.name(targets[j])).substr(1));
+                        long long want = dist[t] == LLONG_MAX ? infDistance : dist[t];
+                        long long wantChanges = exchanges[t].first == LLONG_MAX ? INT_MAX : exchanges[t].first;
+                        if (matrix[j] != want || (withChanges && changeMatrix[j] != wantChanges))
+                            fail(where + "matrix row S" + to_string(s) + " differs at S" + to_string(t));
+                    }
+                }
+
+                // /reachable at the median distance and at the median time. A
+                // station is listed once, with its cheapest cost and the fewest
+                // changes at that cost.
+                for (bool timed : {false, true}) {
+                    vector<long long> within;
+                    for (int t = 0; t < stationCount; t++) {
+                        if (id[t] != -1 && times[t].first != LLONG_MAX) within.push_back(timed ? times[t].first : dist[t]);
+                    }
+                    sort(within.begin(), within.end());
+                    int budget = within[within.size() / 2];
+
+                    vector<array<int,3>> reached;
+                    if (timed) metro.reachable<true>(id[s], budget, reached);
+                    else metro.reachable<false>(id[s], budget, reached);
+                    size_t expected = upper_bound(within.begin(), within.end(), budget) - within.begin();
+                    bool exact = reached.size() == expected;
+                    for (auto [station, cost, lineChanges] : reached) {
+                        int t = stoi(string(metro.stations.name(station)).substr(1));
+                        auto best = timed ? times[t] : lengths[t];
+                        exact = exact && cost == best.first && lineChanges == best.second;
+                    }
+                    if (!exact)
+                        fail(where + "reachable from S" + to_string(s) + " within " + to_string(budget) +
+                             (timed ? " s" : " m") + " differs");
+                }
+            }
+        }
+    }
+
+    remove(filename.c_str());
+    remove(coordinatesFile.c_str());
+    cout << networks << " networks (" << withHeuristic << " with an A* heuristic), " << failures << " mismatches" << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,265 @@
+// g++ benchmarking/generate_network.cpp -o generate_network -std=c++17 -O2
+// Synthetic transit network generator for scale testing. Writes the same schemas as
+// public/dataset: <prefix>_lines.csv (Station1,Station2,Color,distance) and
+// <prefix>_coordinates.csv (Station,X,Y,Color). Output depends only on the options,
+// so two runs with the same seed produce byte-identical files.
+//
+// ./generate_network --lines 40 --stations-per-line 500 --interchange-density 0.05 --topology grid --seed 7
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+// splitmix64: portable, unlike the std distributions whose output varies by library
+struct Random {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    double uniform(double lo, double hi) { return lo + (hi - lo) * uniform(); }
+};
+
+struct Options {
+    int lines = 20;
+    int stationsPerLine = 50;
+    double interchangeDensity = 0.1;  // chance that a stop is merged with a nearby stop of another line
+    string topology = "grid";         // grid | radial
+    uint64_t seed = 1;
+    string prefix = "synthetic";
+};
+
+struct Point {
+    double x;  // km east of the centre
+    double y;  // km north of the centre
+};
+
+const double stationSpacingKm = 1.2;
+const double centreLon = 77.2090;
+const double centreLat = 28.6139;
+const double pi = 3.14159265358979323846;
+
+// Each line is a polyline of stops. `closed` lines (rings) connect the last stop to the first.
+struct Line {
+    vector<Point> stops;
+    bool closed = false;
+};
+
+vector<Line> gridLines(const Options& opt, Random& rng) {
+    // Alternate horizontal and vertical lines across a square sized for the stop count
+    vector<Line> lines(opt.lines);
+    double span = opt.stationsPerLine * stationSpacingKm;
+    int horizontal = (opt.lines + 1) / 2, vertical = opt.lines / 2;
+
+    for (int i = 0; i < opt.lines; i++) {
+        bool isHorizontal = i % 2 == 0;
+        int index = i / 2, count = isHorizontal ? horizontal : vertical;
+        double across = -span / 2 + span * (index + 0.5) / max(count, 1);
+
+        double along = -span / 2;
+        for (int s = 0; s < opt.stationsPerLine; s++) {
+            double wobble = rng.uniform(-0.3, 0.3);
+            Point p = isHorizontal ? Point{along, across + wobble} : Point{across + wobble, along};
+            lines[i].stops.push_back(p);
+            along += stationSpacingKm * rng.uniform(0.7, 1.3);
+        }
+    }
+    return lines;
+}
+
+vector<Line> radialLines(const Options& opt, Random& rng) {
+    // Every fourth line is a ring, the rest are spokes crossing the centre
+    vector<Line> lines(opt.lines);
+    int rings = opt.lines / 4, spokes = opt.lines - rings, ring = 0, spoke = 0;
+
+    for (int i = 0; i < opt.lines; i++) {
+        if (i % 4 == 3) {
+            double radius = stationSpacingKm * opt.stationsPerLine / (2 * pi) * (ring + 1) / max(rings, 1);
+            radius = max(radius, stationSpacingKm);
+            for (int s = 0; s < opt.stationsPerLine; s++) {
+                double angle = 2 * pi * s / opt.stationsPerLine + rng.uniform(-0.02, 0.02);
+                lines[i].stops.push_back({radius * cos(angle), radius * sin(angle)});
+            }
+            lines[i].closed = opt.stationsPerLine > 2;
+            ring++;
+        } else {
+            double angle = pi * spoke / max(spokes, 1);
+            double offset = rng.uniform(-0.5, 0.5);  // spokes pass near, not exactly through, the centre
+            double along = -opt.stationsPerLine * stationSpacingKm / 2;
+            for (int s = 0; s < opt.stationsPerLine; s++) {
+                double wobble = rng.uniform(-0.2, 0.2);
+                lines[i].stops.push_back({along * cos(angle) - (offset + wobble) * sin(angle),
+                                          along * sin(angle) + (offset + wobble) * cos(angle)});
+                along += stationSpacingKm * rng.uniform(0.7, 1.3);
+            }
+            spoke++;
+        }
+    }
+    return lines;
+}
+
+struct DisjointSet {
+    vector<int> parent;
+
+    explicit DisjointSet(int n) : parent(n) {
+        for (int i = 0; i < n; i++) parent[i] = i;
+    }
+
+    int find(int x) {
+        while (parent[x] != x) x = parent[x] = parent[parent[x]];
+        return x;
+    }
+};
+
+double straightLineKm(Point a, Point b) {
+    return hypot(a.x - b.x, a.y - b.y);
+}
+
+bool parseOptions(int argc, char* argv[], Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) return false;
+        string value = argv[++i];
+
+        if (arg == "--lines") opt.lines = atoi(value.c_str());
+        else if (arg == "--stations-per-line") opt.stationsPerLine = atoi(value.c_str());
+        else if (arg == "--interchange-density") opt.interchangeDensity = atof(value.c_str());
+        else if (arg == "--topology") opt.topology = value;
+        else if (arg == "--seed") opt.seed = strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--prefix") opt.prefix = value;
+        else return false;
+    }
+    return opt.lines > 0 && opt.stationsPerLine > 1 && opt.interchangeDensity >= 0 &&
+           opt.interchangeDensity <= 1 && (opt.topology == "grid" || opt.topology == "radial");
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        cout << "Usage: " << argv[0] << " [--lines N] [--stations-per-line N] [--interchange-density 0..1]"
+             << " [--topology grid|radial] [--seed N] [--prefix name]" << endl;
+        return 1;
+    }
+
+    Random rng{opt.seed};
+    vector<Line> lines = opt.topology == "grid" ? gridLines(opt, rng) : radialLines(opt, rng);
+
+    // Flatten stops; stop IDs are line-major
+    vector<Point> stops;
+    vector<int> stopLine, stopIndex;
+    for (int i = 0; i < opt.lines; i++) {
+        for (size_t s = 0; s < lines[i].stops.size(); s++) {
+            stops.push_back(lines[i].stops[s]);
+            stopLine.push_back(i);
+            stopIndex.push_back(s);
+        }
+    }
+
+    // Spatial hash over stops for the nearest-stop-of-another-line query
+    double cell = stationSpacingKm * 1.5;
+    auto cellKey = [&](double x, double y) {
+        int64_t cx = (int64_t)floor(x / cell), cy = (int64_t)floor(y / cell);
+        return (uint64_t)(cx * 73856093) ^ (uint64_t)(cy * 19349663);
+    };
+    unordered_multimap<uint64_t, int> grid;
+    grid.reserve(stops.size());
+    for (size_t i = 0; i < stops.size(); i++) grid.emplace(cellKey(stops[i].x, stops[i].y), i);
+
+    // Interchanges: merge a stop into the closest stop of a different line within one cell
+    DisjointSet merged(stops.size());
+    vector<char> isInterchange(stops.size(), 0);
+    for (size_t i = 0; i < stops.size(); i++) {
+        if (rng.uniform() >= opt.interchangeDensity || isInterchange[i]) continue;
+
+        int best = -1;
+        double bestKm = cell;
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                auto range = grid.equal_range(cellKey(stops[i].x + dx * cell, stops[i].y + dy * cell));
+                for (auto it = range.first; it != range.second; ++it) {
+                    int j = it->second;
+                    if (stopLine[j] == stopLine[i] || isInterchange[j]) continue;
+                    double km = straightLineKm(stops[i], stops[j]);
+                    if (km < bestKm || (km == bestKm && j < best)) {
+                        bestKm = km;
+                        best = j;
+                    }
+                }
+            }
+        }
+
+        if (best != -1) {
+            merged.parent[merged.find(i)] = merged.find(best);
+            isInterchange[i] = isInterchange[best] = 1;
+        }
+    }
+
+    auto stationName = [&](int stop) {
+        int root = merged.find(stop);
+        return "L" + to_string(stopLine[root] + 1) + " Stop " + to_string(stopIndex[root] + 1);
+    };
+    auto lineColor = [](int line) { return "Line " + to_string(line + 1); };
+
+    // Merged stops sit at the position of the stop they were merged into
+    auto position = [&](int stop) { return stops[merged.find(stop)]; };
+
+    string linesPath = opt.prefix + "_lines.csv";
+    string coordinatesPath = opt.prefix + "_coordinates.csv";
+    ofstream linesFile(linesPath, ios::binary | ios::trunc);
+    ofstream coordinatesFile(coordinatesPath, ios::binary | ios::trunc);
+    if (!linesFile.is_open() || !coordinatesFile.is_open()) {
+        cout << "Error writing " << linesPath << " / " << coordinatesPath << endl;
+        return 1;
+    }
+
+    linesFile << "Station1,Station2,Color,distance\n";
+    coordinatesFile << "Station,X,Y,Color\n";
+    coordinatesFile.setf(ios::fixed);
+    coordinatesFile.precision(7);
+
+    size_t rows = 0, stations = 0, first = 0;
+    for (int line = 0; line < opt.lines; line++) {
+        size_t count = lines[line].stops.size();
+        size_t segments = lines[line].closed ? count : count - 1;
+
+        for (size_t s = 0; s < segments; s++) {
+            int a = first + s, b = first + (s + 1) % count;
+            if (merged.find(a) == merged.find(b)) continue;
+
+            // Track is never shorter than the straight line; round to the dataset's 0.1 km
+            double km = straightLineKm(position(a), position(b)) * rng.uniform(1.05, 1.3);
+            km = max(0.1, round(km * 10) / 10);
+            linesFile << stationName(a) << "," << stationName(b) << "," << lineColor(line) << "," << km << "\n";
+            rows++;
+        }
+
+        for (size_t s = 0; s < count; s++) {
+            int stop = first + s;
+            if (merged.find(stop) != (int)stop) continue;
+
+            Point p = stops[stop];
+            double lon = centreLon + p.x / (111.320 * cos(centreLat * pi / 180));
+            double lat = centreLat + p.y / 110.574;
+            coordinatesFile << stationName(stop) << "," << lon << "," << lat << "," << lineColor(line) << "\n";
+            stations++;
+        }
+
+        first += count;
+    }
+
+    cout << "Wrote " << rows << " rows to " << linesPath << " and " << stations << " stations to "
+         << coordinatesPath << " (" << opt.topology << ", seed " << opt.seed << ")" << endl;
+    return 0;
+}
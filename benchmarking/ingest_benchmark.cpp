@@ -0,0 +1,140 @@
+// g++ benchmarking/ingest_benchmark.cpp -o ingest_benchmark -std=c++17 -O2 -pthread -I./include
+// Compares the stringstream CSV loader against MetroGraph::loadFromFile on a synthetic dataset.
+// Usage: ./ingest_benchmark [rows]
+#define METRO_NO_MAIN
+#include "../main.cpp"
+
+#include <sstream>
+
+// The loader main.cpp used before the single-pass version, kept here as the baseline
+struct LegacyLoader {
+    struct Connection {
+        string station;
+        double distance;
+        string lineColor;
+    };
+
+    unordered_map<string, vector<Connection>> adjList;
+    unordered_map<string, int> stationToId;
+    unordered_map<string, int> lineToId;
+
+    void trim(string &s) {
+        s.erase(s.begin(), find_if(s.begin(), s.end(), [](unsigned char ch) { return !isspace(ch); }));
+        s.erase(find_if(s.rbegin(), s.rend(), [](unsigned char ch) { return !isspace(ch); }).base(), s.end());
+    }
+
+    void addEdge(string station1, string station2, double distance, string lineColor) {
+        trim(station1);
+        trim(station2);
+        trim(lineColor);
+
+        if (!station1.empty() && !station2.empty() && station1 != station2) {
+            adjList[station1].push_back({station2, distance, lineColor});
+            adjList[station2].push_back({station1, distance, lineColor});
+        }
+    }
+
+    void loadFromFile(string filename) {
+        ifstream file(filename);
+        string line, station1, station2, lineColor;
+        double distance;
+
+        getline(file, line); // Skip header
+
+        while (getline(file, line)) {
+            stringstream ss(line);
+            getline(ss, station1, ',');
+            getline(ss, station2, ',');
+            getline(ss, lineColor, ',');
+            ss >> distance;
+
+            addEdge(station1, station2, distance, lineColor);
+        }
+
+        // ID assignment, the first half of the old buildIntegerGraph()
+        int stationId = 0;
+        for (auto& station : adjList) {
+            stationToId[station.first] = stationId++;
+            for (auto& neighbor : station.second) {
+                if (!lineToId.count(neighbor.lineColor)) {
+                    int lineId = lineToId.size();
+                    lineToId[neighbor.lineColor] = lineId;
+                }
+            }
+        }
+    }
+};
+
+// Lines of consecutive stations with CRLF endings, roughly 40 bytes per row
+size_t writeSyntheticCsv(const string& filename, int rows) {
+    ofstream file(filename, ios::binary | ios::trunc);
+    file << "Station1,Station2,Color,distance\r\n";
+
+    const int stationsPerLine = 500;
+    uint64_t state = 42;
+    for (int i = 0; i < rows; i++) {
+        int line = i / stationsPerLine;
+        int stop = i % stationsPerLine;
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        double km = 0.5 + (state >> 33) % 250 / 100.0;
+
+        file << "Station " << line << "-" << stop << ",Station " << line << "-" << stop + 1
+             << ",Line " << line << "," << km << "\r\n";
+    }
+
+    return file.tellp();
+}
+
+template <typename F>
+double bestOf(int runs, F&& body) {
+    double best = numeric_limits<double>::infinity();
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        body();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int rows = argc > 1 ? atoi(argv[1]) : 200000;
+    string filename = "ingest_benchmark.csv";
+    size_t bytes = writeSyntheticCsv(filename, rows);
+    double megabytes = bytes / (1024.0 * 1024.0);
+
+    cout << "Synthetic dataset: " << rows << " rows, " << megabytes << " MB" << endl;
+
+    size_t legacyStations = 0, stations = 0;
+
+    double legacy = bestOf(3, [&] {
+        LegacyLoader loader;
+        loader.loadFromFile(filename);
+        legacyStations = loader.stationToId.size();
+    });
+
+    double singlePass = bestOf(3, [&] {
+        MetroGraph metro;
+        metro.loadFromFile(filename);
+        stations = metro.stations.size();
+    });
+
+    double fullBuild = bestOf(3, [&] {
+        MetroGraph metro;
+        metro.loadFromFile(filename);
+        metro.buildIntegerGraph();
+    });
+
+    if (legacyStations != stations) {
+        cout << "Station count mismatch: " << legacyStations << " vs " << stations << endl;
+        return 1;
+    }
+
+    cout << "stringstream loader:  " << legacy << " ms (" << megabytes / legacy * 1000 << " MB/s)" << endl;
+    cout << "single-pass loader:   " << singlePass << " ms (" << megabytes / singlePass * 1000 << " MB/s)" << endl;
+    cout << "single-pass + CSR:    " << fullBuild << " ms" << endl;
+    cout << "Speedup: " << legacy / singlePass << "x" << endl;
+
+    remove(filename.c_str());
+    return 0;
+}
@@ -0,0 +1,88 @@
+// g++ benchmarking/queue_benchmark.cpp -o queue_benchmark -std=c++17 -O2 -pthread -I./include
+// Compares the queues of the Dijkstra core on the same pairs: binary heap and
+// radix heap for both searches, plus per-level buckets for minimum exchanges.
+// Usage: ./queue_benchmark [lines.csv] [queries]
+#define METRO_NO_MAIN
+#include "../main.cpp"
+
+// Same pairs for every run, so both queues see identical work
+vector<pair<int,int>> randomPairs(int stationCount, int count) {
+    vector<pair<int,int>> pairs;
+    uint64_t state = 7;
+    for (int i = 0; i < count; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        int source = (state >> 33) % stationCount;
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        int dest = (state >> 33) % stationCount;
+        pairs.push_back({source, dest});
+    }
+    return pairs;
+}
+
+template <typename F>
+double bestOf(int runs, F&& body) {
+    double best = numeric_limits<double>::infinity();
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        body();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    string filename = argc > 1 ? argv[1] : "public/dataset/Delhi_Metro_Lines.csv";
+    int queries = argc > 2 ? atoi(argv[2]) : 2000;
+
+    // Searches only: skip the indexes and the line graph that would answer queries without them
+    routingTableMaxBytes = 0;
+    transferPatternMaxStations = 0;
+    useLineGraph = false;
+    useContractionHierarchy = false;
+
+    MetroGraph metro;
+    metro.loadFromFile(filename);
+    metro.buildIntegerGraph();
+    if (metro.stations.size() == 0) return 1;
+
+    auto pairs = randomPairs(metro.stations.size(), queries);
+    SearchLabels labels;
+    vector<int> route, hopLines;
+    vector<long long> distanceAnswers[3], exchangeAnswers[3];
+    const char* names[3] = {"binary heap:  ", "radix heap:   ", "level buckets:"};
+
+    cout << queries << " queries on " << metro.stations.size() << " stations" << endl;
+
+    for (int queue = 0; queue < 3; queue++) {
+        useRadixHeap = queue >= 1;
+        useLevelBuckets = queue == 2;
+
+        double shortest = bestOf(3, [&] {
+            distanceAnswers[queue].clear();
+            for (auto [source, dest] : pairs) {
+                metro.dijkstraSearch(source, dest, labels);
+                distanceAnswers[queue].push_back(labels.dist(dest));
+            }
+        });
+
+        double exchanges = bestOf(3, [&] {
+            exchangeAnswers[queue].clear();
+            for (auto [source, dest] : pairs) {
+                auto [lineChanges, metres] = metro.minimumExchangeRoute(source, dest, route, hopLines);
+                exchangeAnswers[queue].push_back((long long)lineChanges << 32 | metres);
+            }
+        });
+
+        // Level buckets only change the exchange search
+        cout << names[queue] << " shortest " << shortest * 1000 / queries << " us/query, exchanges "
+             << exchanges * 1000 / queries << " us/query" << endl;
+    }
+
+    if (distanceAnswers[0] != distanceAnswers[1] || exchangeAnswers[0] != exchangeAnswers[1] ||
+        exchangeAnswers[0] != exchangeAnswers[2]) {
+        cout << "Answers differ between queues" << endl;
+        return 1;
+    }
+    return 0;
+}
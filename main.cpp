@@ -4,360 +4,3538 @@
 #include <list>
 #include <tuple>
 #include <fstream>
-#include <sstream>
 #include <queue>
 #include <limits>
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <charconv>
+#include <chrono>
+#include <deque>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
 #include <httplib.h>
 #include <nlohmann/json.hpp>
 #include <mutex>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 size_t cacheCapacity = 1000;
+size_t matrixMaxCells = 250000;  // /matrix refuses more sources x targets than this
+size_t sourceTreeCapacity = 32;  // full shortest-path trees kept for the busiest sources (0 = none)
+bool useChainOverlay = true;  // run /shortest_path on the chain-contracted overlay
+bool useContractionHierarchy = true;  // preprocess shortcuts for the "ch" engine
+int witnessSettleLimit = 500;         // nodes a witness search may settle before a shortcut is added anyway
+size_t hubLabelMaxStations = 20000;  // build hub labels up to this many stations (0 = never)
+int altLandmarkCount = 16;            // landmarks for the "alt" engine (0 = none)
+bool useRadixHeap = true;             // monotone radix heap in the Dijkstra core instead of a binary heap
+bool useLevelBuckets = true;          // exchange search: per-level radix heaps instead of packed keys
+size_t routingTableMaxBytes = 2 << 20;  // all-pairs tables above this size fall back to search (0 = never)
+size_t transferPatternMaxStations = 3000;  // transfer patterns for /min_exchanges up to this size (0 = never)
+bool useLineGraph = true;  // minimum-exchange searches: count changes on the line graph first
+int trainSpeedKmh = 32;           // /route?mode=time: average running speed between stops
+int dwellSeconds = 30;            // /route?mode=time: stop at each station reached
+int transferSeconds = 240;        // /route?mode=time: walk and wait per line change
+int exchangePenaltyMetres = 5000; // /route?mode=cost: one line change weighs as much as this much riding
+int datasetPollSeconds = 5;             // reload the graph when its source file changes (0 = never)
 
 using json = nlohmann::json;
 using namespace std;
 
+string shortestPathEngine = "auto";  // default for /shortest_path; requests may pick another with ?engine=
+
 mutex cacheMutex;
+mutex sourceTreeMutex;
+
+// Point-to-point engines behind /shortest_path. Auto takes the routing table
+// when it is built, then hub labels, then a cached tree of a busy source, then
+// the contraction hierarchy, then the overlay, then plain Dijkstra.
+enum ShortestPathEngine { EngineAuto, EngineTable, EngineOverlay, EngineDijkstra, EngineBidirectional, EngineAStar,
+                          EngineHierarchy, EngineHubLabels, EngineLandmarks, EngineTree, EngineCount };
+const char* const engineNames[EngineCount] = {"auto", "table", "overlay", "dijkstra", "bidirectional", "astar", "ch",
+                                              "hub", "alt", "tree"};
+
+// Returns EngineCount for an unknown name
+ShortestPathEngine engineFromName(string_view name) {
+    for (int i = 0; i < EngineCount; i++) {
+        if (name == engineNames[i]) return (ShortestPathEngine)i;
+    }
+    return EngineCount;
+}
+
+// What /route minimises: metres, line changes (then metres), travel time, or
+// metres with a penalty per line change
+enum RouteMode { ModeDistance, ModeExchanges, ModeTime, ModeCost, ModeCount };
+const char* const modeNames[ModeCount] = {"distance", "exchanges", "time", "cost"};
+
+// Returns ModeCount for an unknown name
+RouteMode modeFromName(string_view name) {
+    for (int i = 0; i < ModeCount; i++) {
+        if (name == modeNames[i]) return (RouteMode)i;
+    }
+    return ModeCount;
+}
+
+// Searches run and nodes settled per engine, kept across graph reloads so that
+// engines can be compared on live traffic. Cache hits are not counted.
+// reachable sums the source component sizes, which plain Dijkstra could settle
+// at worst, so 1 - settled / reachable is the share of the search pruned away.
+struct EngineStats {
+    atomic<uint64_t> queries{0};
+    atomic<uint64_t> settled{0};
+    atomic<uint64_t> reachable{0};
+};
+EngineStats engineStats[EngineCount];
+
+// One CSV row after interning: both stations and the line are already IDs
+struct RawEdge {
+    int from;
+    int to;
+    int metres;
+    int lineId;
+};
+
+// Edge weights are stored as whole metres so that searches compare exact integers
+const int metresPerKm = 1000;
+const int infDistance = numeric_limits<int>::max();
+
+inline int toMetres(double km) {
+    return (int)lround(km * metresPerKm);
+}
+
+inline double toKm(int metres) {
+    return (double)metres / metresPerKm;
+}
+
+// 1-based index of the highest set bit, 0 for x == 0
+inline int highestBit(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    return _BitScanReverse64(&index, x) ? index + 1 : 0;
+#else
+    return x ? 64 - __builtin_clzll(x) : 0;
+#endif
+}
+
+// Queues for the search core: push(key, value), pop() -> smallest {key, value}.
+// Both keep their storage between searches when reused through clear().
+template <typename Key>
+class BinaryHeap {
+public:
+    bool empty() const { return items.empty(); }
+    void clear() { items.clear(); }
+
+    void push(Key key, int value) {
+        items.push_back({key, value});
+        push_heap(items.begin(), items.end(), greater<>());
+    }
+
+    const pair<Key,int>& top() const { return items.front(); }
+
+    pair<Key,int> pop() {
+        pop_heap(items.begin(), items.end(), greater<>());
+        auto item = items.back();
+        items.pop_back();
+        return item;
+    }
+
+private:
+    vector<pair<Key,int>> items;
+};
+
+// Radix heap for monotone searches, where no key pushed is smaller than the
+// last key popped. Bucket i holds keys whose highest bit differing from that
+// last key is bit i - 1, so a key moves to lower buckets at most once per bit
+// instead of paying O(log n) per operation.
+template <typename Key>
+class RadixHeap {
+public:
+    bool empty() const { return count == 0; }
+
+    void clear() {
+        for (auto& bucket : buckets) bucket.clear();
+        last = 0;
+        count = 0;
+    }
+
+    void push(Key key, int value) {
+        buckets[highestBit(key ^ last)].push_back({key, value});
+        count++;
+    }
+
+    pair<Key,int> pop() {
+        if (buckets[0].empty()) {
+            // Redistribute the first non-empty bucket around its smallest key
+            int i = 1;
+            while (buckets[i].empty()) i++;
+
+            last = min_element(buckets[i].begin(), buckets[i].end())->first;
+            for (auto& item : buckets[i]) buckets[highestBit(item.first ^ last)].push_back(item);
+            buckets[i].clear();
+        }
+
+        auto item = buckets[0].back();
+        buckets[0].pop_back();
+        count--;
+        return item;
+    }
+
+private:
+    vector<pair<Key,int>> buckets[sizeof(Key) * 8 + 1];
+    Key last = 0;
+    size_t count = 0;
+};
+
+// Queue for (changes, metres) keys packed with changes in the high word. A
+// line change costs exactly one, so only the level being drained and the one
+// after it can hold entries: two radix heaps of metres, swapped when the
+// current level runs out. Each heap is monotone within its level, and a pop
+// never compares change counts.
+class LevelBucketQueue {
+public:
+    bool empty() const { return count == 0; }
+
+    void clear() {
+        levels[0].clear();
+        levels[1].clear();
+        current = 0;
+        count = 0;
+    }
+
+    // key >> 32 must be the current level or the next one
+    void push(uint64_t key, int value) {
+        levels[(key >> 32) & 1].push((uint32_t)key, value);
+        count++;
+    }
+
+    pair<uint64_t,int> pop() {
+        if (levels[current & 1].empty()) {
+            levels[current & 1].clear();  // reused for current + 2, which starts from metres 0
+            current++;
+        }
+
+        auto [metres, value] = levels[current & 1].pop();
+        count--;
+        return {(uint64_t)current << 32 | metres, value};
+    }
+
+private:
+    RadixHeap<uint32_t> levels[2];  // levels[l & 1] holds level l
+    uint64_t current = 0;
+    size_t count = 0;
+};
+
+// Labels of one search over stations, line states or overlay nodes. An entry
+// is unset unless its stamp is the current generation, so reset() costs one
+// increment instead of a pass over every entry.
+class SearchLabels {
+public:
+    struct Label {
+        int dist;
+        int parent;
+        int tag;  // parent edge, or line changes in the exchange search
+    };
+
+    // Searches over stations, overlay nodes and line states share one set, so
+    // it only grows: a smaller search uses a prefix, and new entries start
+    // unset because generation is never 0 after the increment.
+    void reset(size_t size) {
+        if (stamp.size() < size) {
+            stamp.resize(size, 0);
+            labels.resize(size);
+        }
+        if (++generation == 0) {  // wrapped: old stamps could match again
+            fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
+        }
+    }
+
+    bool reached(int u) const { return stamp[u] == generation; }
+    int dist(int u) const { return reached(u) ? labels[u].dist : infDistance; }
+    const Label& operator[](int u) const { return labels[u]; }  // only for reached entries
+
+    void set(int u, int dist, int parent, int tag = -1) {
+        stamp[u] = generation;
+        labels[u] = {dist, parent, tag};
+    }
+
+private:
+    vector<uint32_t> stamp;
+    vector<Label> labels;
+    uint32_t generation = 0;
+};
+
+// Everything a query needs besides the graph, one per thread and reused: two
+// label sets for the two sides of a bidirectional search, the queues with
+// their storage, and route buffers. Once warm, a query allocates nothing.
+struct SearchWorkspace {
+    SearchLabels labels[2];
+    RadixHeap<uint32_t> radix;
+    BinaryHeap<uint32_t> heap[2];
+    LevelBucketQueue levels;
+    RadixHeap<uint64_t> exchangeRadix;
+    BinaryHeap<uint64_t> exchangeHeap;
+    vector<int> depth[2];  // line graph BFS from each end
+    vector<int> queue;
+    vector<int> walk;      // partial routes, e.g. a hierarchy climb
+    vector<int> route;
+    vector<int> hopLines;
+
+    static SearchWorkspace& local() {
+        thread_local SearchWorkspace workspace;
+        return workspace;
+    }
+};
+
+// Read-only array that either owns its storage or points into a mapped snapshot.
+// Searches only ever read through ptr, so both sources look the same to them.
+template <typename T>
+class FlatArray {
+public:
+    FlatArray() = default;
+    FlatArray(const FlatArray&) = delete;
+    FlatArray& operator=(const FlatArray&) = delete;
+    FlatArray(FlatArray&&) = default;  // moving a vector keeps its buffer, so ptr stays valid
+    FlatArray& operator=(FlatArray&&) = default;
+
+    void assign(vector<T> values) {
+        owned = move(values);
+        ptr = owned.data();
+        count = owned.size();
+    }
+
+    void view(const T* data, size_t size) {
+        owned = vector<T>();
+        ptr = data;
+        count = size;
+    }
+
+    void clear() { assign({}); }
+
+    const T& operator[](size_t i) const { return ptr[i]; }
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+
+private:
+    vector<T> owned;
+    const T* ptr = nullptr;
+    size_t count = 0;
+};
+
+// Whole file mapped read-only (read into memory where mmap is unavailable)
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string& path) {
+        close();
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) return false;
+
+        base = static_cast<const char*>(addr);
+        length = st.st_size;
+#else
+        ifstream file(path, ios::binary);
+        if (!file.is_open()) return false;
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        base = buffer.data();
+        length = buffer.size();
+#endif
+        return true;
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (base) munmap(const_cast<char*>(base), length);
+#else
+        buffer.clear();
+#endif
+        base = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+};
+
+// Station position as a point on a sphere of the Earth's radius, in metres.
+// The straight (chord) distance between two points never exceeds the
+// great-circle distance, and needs no trigonometry per evaluation.
+struct GeoPoint {
+    double x, y, z;
+};
+
+const double earthRadiusMetres = 6371000.0;
+
+inline GeoPoint toGeoPoint(double lonDegrees, double latDegrees) {
+    const double radians = 3.14159265358979323846 / 180;
+    double lon = lonDegrees * radians, lat = latDegrees * radians;
+    return {earthRadiusMetres * cos(lat) * cos(lon), earthRadiusMetres * cos(lat) * sin(lon),
+            earthRadiusMetres * sin(lat)};
+}
+
+inline double chordMetres(const GeoPoint& a, const GeoPoint& b) {
+    double dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+    return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Runs of degree-2 stations collapsed into single edges between interchanges and
+// termini. Every chain keeps its full station sequence so routes can be expanded.
+struct ChainOverlay {
+    vector<int> node;           // overlay index -> station
+    vector<int> nodeOf;         // station -> overlay index, -1 inside a chain
+    vector<int> chainOf;        // station -> chain it is interior to, -1 for overlay nodes
+    vector<int> chainPos;       // station -> position inside its chain
+    vector<int> chainOffset;    // chain c is chainStations[chainOffset[c] .. chainOffset[c + 1])
+    vector<int> chainStations;  // both end stations included
+    vector<int> chainDist;      // metres from the first station of the chain
+
+    // Overlay CSR. chain[e] is c when e runs along chain c from its first station, ~c when reversed
+    vector<int> offset;
+    vector<int> to;
+    vector<int> weight;
+    vector<int> chain;
+};
+
+// Contraction hierarchy over the station graph. Upward edges of the station
+// with rank r are [offset[r], offset[r + 1]) and lead to higher-ranked
+// stations; the graph is undirected, so the same edges serve both directions
+// of a query. A shortcut bypasses middle, whose own upward edges to both ends
+// add up to the shortcut's weight.
+struct ContractionHierarchy {
+    FlatArray<int> rank;    // station -> contraction order
+    FlatArray<int> offset;  // rank -> first upward edge
+    FlatArray<int> to;
+    FlatArray<int> weight;  // metres
+    FlatArray<int> middle;  // -1 for a track edge
+
+    bool empty() const { return rank.size() == 0; }
+};
+
+// Pruned landmark labels: station u's entries are [offset[u], offset[u + 1]),
+// sorted by hub index. Every shortest path between two stations passes a hub
+// the two labels share, so a distance is a merge-join of two labels. parent is
+// the next station from u toward the hub (-1 at the hub itself), and that
+// station's label holds the same hub, so the path can be walked hub-ward.
+struct HubLabels {
+    FlatArray<int> order;   // hub index -> station, most important first
+    FlatArray<int> offset;  // station -> first label entry
+    FlatArray<int> hub;     // hub index
+    FlatArray<int> dist;    // metres to the hub
+    FlatArray<int> parent;
+
+    bool empty() const { return order.size() == 0; }
+};
+
+// ALT landmarks. The graph is undirected, so one table serves as both the
+// distances to and from each landmark. Rows are station-major: the k distances
+// of one station are adjacent and a heuristic evaluation reads one cache line.
+struct Landmarks {
+    FlatArray<int> station;  // landmark -> station
+    FlatArray<int> dist;     // [u * k + i] metres between u and landmark i, infDistance if apart
+
+    int count() const { return station.size(); }
+    bool empty() const { return station.size() == 0; }
+};
+
+// State space for exchange search: one state per (station, line serving it).
+// States of station u are [offset[u], offset[u + 1]), ordered by line ID.
+struct LineStates {
+    vector<int> offset;
+    vector<int> line;       // state -> line ID
+    vector<int> station;    // state -> station
+    vector<int> edgeState;  // CSR edge e -> state of (edgeTo[e], edgeLine[e])
+};
+
+// Lines as nodes, interchange stations as links. A line whose track falls
+// apart into separate stretches gets one node per stretch (a piece), since
+// riding from one stretch to the other needs another line in between.
+struct LineGraph {
+    vector<int> statePiece;  // state -> piece holding it
+    vector<int> pieceLine;   // piece -> line ID
+    vector<int> offset;      // piece -> first of its neighbours in adjacent
+    vector<int> adjacent;    // pieces sharing at least one station
+};
+
+// All-pairs answers for both routing modes. Entries are stored one row per
+// destination t, so walking a route from s to t reads a single row.
+struct RoutingTable {
+    vector<int> dist;          // [t * n + s] shortest metres from s to t
+    vector<int> next;          // [t * n + s] station after s on that route, -1 at t
+    vector<int> changes;       // [t * n + s] minimum line changes from s to t
+    vector<int> exchangeDist;  // [t * n + s] metres on that minimum-exchange route
+    vector<int> firstState;    // [t * n + s] state s departs in, i.e. the first line ridden
+    vector<int> nextState;     // [t * states + k] state after k toward t, -1 at t
+
+    bool empty() const { return dist.empty(); }
+};
+
+// Line sequences of every optimal minimum-exchange route. For each source, the
+// legs of its routes form a trie: a node is one leg, named by the state it
+// boards (station and line), and points at the leg before it. Destinations
+// reached on the same legs share nodes, so a source needs roughly one node per
+// interchange used rather than one per destination. No distances are kept per
+// pair; a pattern is evaluated against along-line distances when queried.
+struct TransferPatterns {
+    vector<int> lineOffset;       // line -> first of its stations in lineStation
+    vector<int> lineStation;      // stations served by each line
+    vector<int> stateIndex;       // state -> position of its station within its line
+    vector<size_t> matrixOffset;  // line -> first entry of its distance matrix
+    vector<int> lineDist;         // [matrixOffset[l] + i * size + j] metres from i to j riding line l only
+    vector<int> lineNext;         // [matrixOffset[l] + i * size + j] stop after j on that ride toward i, -1 at i
+
+    vector<int> nodeOffset;       // source -> first of its trie nodes
+    vector<int> nodeParent;       // node -> previous leg, as an index among the source's nodes; -1 for the first
+    vector<int> nodeBoard;        // node -> state the leg boards in
+    vector<uint16_t> lastLeg;     // [s * n + t] final leg from s to t among s's nodes, noLeg if none
+
+    static constexpr uint16_t noLeg = UINT16_MAX;
+
+    bool empty() const { return nodeOffset.empty(); }
+};
+
+// Complete result of one single-source search
+struct SourceTree {
+    int source;
+    vector<int> dist;    // station -> metres from source, infDistance if apart
+    vector<int> parent;  // station -> previous station on the way from source, -1 at source or if apart
+};
+
+// Trees of the most requested sources. Every lookup counts toward its source,
+// and the counts halve every agingPeriod lookups so that old peaks fade. A
+// source asked for twice gets a tree; when the cache is full, the new tree
+// replaces the one whose source has the lowest count, and only if its own
+// count is higher. Trees are shared, so a query can keep walking one after it
+// has been evicted.
+struct SourceTreeCache {
+    vector<shared_ptr<const SourceTree>> trees;
+    unordered_map<int, uint32_t> frequency;  // source -> recent lookups
+    uint32_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t builds = 0;
+
+    static const uint32_t agingPeriod = 4096;
+
+    uint32_t count(int source) const {
+        auto it = frequency.find(source);
+        return it == frequency.end() ? 0 : it->second;
+    }
+
+    // Tree whose source has the fewest recent lookups
+    size_t victim() const {
+        size_t worst = 0;
+        for (size_t i = 1; i < trees.size(); i++) {
+            if (count(trees[i]->source) < count(trees[worst]->source)) worst = i;
+        }
+        return worst;
+    }
+};
+
+// Names stored once, back to back, in one arena. Lookup goes through an
+// open-addressing table of IDs hashed with FNV-1a, so resolving a string_view
+// costs one probe sequence and no allocation. All three arrays can be mapped.
+class NameTable {
+public:
+    void build(const vector<string_view>& names) {
+        vector<char> arena;
+        vector<uint32_t> offsets = {0};
+        for (auto name : names) {
+            arena.insert(arena.end(), name.begin(), name.end());
+            offsets.push_back(arena.size());
+        }
+
+        size_t capacity = 8;
+        while (capacity < names.size() * 2) capacity *= 2;
+        vector<int> table(capacity, -1);
+        for (size_t id = 0; id < names.size(); id++) {
+            size_t slot = hash(names[id]) & (capacity - 1);
+            while (table[slot] != -1) slot = (slot + 1) & (capacity - 1);
+            table[slot] = id;
+        }
+
+        pool.assign(move(arena));
+        offset.assign(move(offsets));
+        slots.assign(move(table));
+    }
+
+    // Returns -1 when the name is unknown
+    int find(string_view name) const {
+        if (slots.size() == 0) return -1;
+        size_t mask = slots.size() - 1;
+        for (size_t slot = hash(name) & mask; slots[slot] != -1; slot = (slot + 1) & mask) {
+            if (this->name(slots[slot]) == name) return slots[slot];
+        }
+        return -1;
+    }
+
+    string_view name(int id) const {
+        return string_view(pool.data() + offset[id], offset[id + 1] - offset[id]);
+    }
+
+    int size() const { return offset.size() == 0 ? 0 : (int)offset.size() - 1; }
+
+    static uint64_t hash(string_view name) {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned char ch : name) {
+            h ^= ch;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    FlatArray<char> pool;
+    FlatArray<uint32_t> offset;  // size() + 1 entries into pool
+    FlatArray<int> slots;        // power-of-two table of IDs, -1 = empty
+};
+
+// Binary graph snapshot: header, section directory, then 8-byte aligned sections.
+// Integers are stored in native byte order; byteOrderMark rejects foreign files.
+const char snapshotMagic[8] = {'D', 'V', 'S', 'N', 'A', 'P', '\0', '\0'};
+const uint32_t snapshotVersion = 2;
+const uint32_t byteOrderMark = 0x01020304;
+
+enum SnapshotSection : uint32_t {
+    SECTION_STATION_OFFSETS = 1,  // uint32[n + 1] into the station pool
+    SECTION_STATION_POOL,         // concatenated station names
+    SECTION_LINE_OFFSETS,         // uint32[lines + 1] into the line pool
+    SECTION_LINE_POOL,            // concatenated line names
+    SECTION_ADJ_OFFSET,           // int32[n + 1]
+    SECTION_EDGE_TO,              // int32[m]
+    SECTION_EDGE_WEIGHT,          // int32[m], metres
+    SECTION_EDGE_LINE,            // int32[m]
+    SECTION_STATION_SLOTS,        // int32 station name hash table
+    SECTION_LINE_SLOTS,           // int32 line name hash table
+    SECTION_CH_RANK,              // int32[n], optional: contraction hierarchy
+    SECTION_CH_OFFSET,            // int32[n + 1]
+    SECTION_CH_TO,                // int32[shortcuts + edges]
+    SECTION_CH_WEIGHT,            // int32[shortcuts + edges]
+    SECTION_CH_MIDDLE,            // int32[shortcuts + edges]
+    SECTION_HUB_ORDER,            // int32[n], optional: hub labels
+    SECTION_HUB_OFFSET,           // int32[n + 1]
+    SECTION_HUB_INDEX,            // int32[entries]
+    SECTION_HUB_DIST,             // int32[entries]
+    SECTION_HUB_PARENT,           // int32[entries]
+    SECTION_ALT_LANDMARKS,        // int32[k], optional: ALT landmarks
+    SECTION_ALT_DIST,             // int32[n * k], station-major
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t sectionCount;
+    uint32_t reserved;
+};
+
+struct SnapshotSectionEntry {
+    uint32_t tag;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+static_assert(sizeof(int) == 4, "snapshot format assumes 32-bit int");
+
+
+class MetroGraph {
+public:
+    vector<RawEdge> rawEdges;  // loaded rows, consumed by buildIntegerGraph()
+    NameTable stations;
+    // CSR adjacency: edges of station u are [adjOffset[u], adjOffset[u + 1]),
+    // stored column-wise so the relaxation loop streams each field separately
+    FlatArray<int> adjOffset;
+    FlatArray<int> edgeTo;
+    FlatArray<int> edgeWeight;  // metres
+    FlatArray<int> edgeLine;
+    NameTable lines;
+    MappedFile snapshot;
+    ChainOverlay overlay;
+    ContractionHierarchy hierarchy;
+    HubLabels hubLabels;
+    Landmarks landmarks;
+    LineStates lineStates;
+    LineGraph lineGraph;
+    RoutingTable routingTable;
+    TransferPatterns patterns;
+    SourceTreeCache sourceTrees;  // guarded by sourceTreeMutex
+    vector<GeoPoint> stationPoint;  // station -> position, from the coordinates file
+    vector<char> hasPoint;          // station -> listed in the coordinates file
+    double geoScale = 0;            // metres of track per metre of chord, at least; 0 = no A*
+    vector<int> componentOf;    // station -> connected component
+    vector<int> componentSize;  // component -> number of stations
+    list<string> lruList;  // Most recent at front
+    unordered_map<string, pair<json, list<string>::iterator>> routeCache;
+
+    static string_view trim(string_view s) {
+        while (!s.empty() && isspace((unsigned char)s.front())) s.remove_prefix(1);
+        while (!s.empty() && isspace((unsigned char)s.back())) s.remove_suffix(1);
+        return s;
+    }
+
+    // Splits the record starting at pos into fields and advances pos past its line
+    // break. Quoted fields may contain commas, doubled quotes and line breaks; only
+    // those with doubled quotes are copied (into unescaped), the rest view data.
+    static bool nextCsvRecord(string_view data, size_t& pos, vector<string_view>& fields,
+                              deque<string>& unescaped) {
+        fields.clear();
+        if (pos >= data.size()) return false;
+
+        while (true) {
+            size_t start = pos;
+            while (pos < data.size() && (data[pos] == ' ' || data[pos] == '\t')) pos++;
+
+            if (pos < data.size() && data[pos] == '"') {
+                size_t contentStart = ++pos;
+                bool escaped = false;
+                while (pos < data.size()) {
+                    if (data[pos] == '"') {
+                        if (pos + 1 < data.size() && data[pos + 1] == '"') {
+                            escaped = true;
+                            pos += 2;
+                            continue;
+                        }
+                        break;
+                    }
+                    pos++;
+                }
+                string_view content = data.substr(contentStart, pos - contentStart);
+                if (pos < data.size()) pos++;  // closing quote
+
+                if (escaped) {
+                    string& copy = unescaped.emplace_back();
+                    for (size_t i = 0; i < content.size(); i++) {
+                        copy += content[i];
+                        if (content[i] == '"') i++;
+                    }
+                    content = copy;
+                }
+                fields.push_back(content);
+
+                // Anything between the closing quote and the separator is ignored
+                while (pos < data.size() && data[pos] != ',' && data[pos] != '\n') pos++;
+            } else {
+                pos = start;
+                while (pos < data.size() && data[pos] != ',' && data[pos] != '\n') pos++;
+                fields.push_back(trim(data.substr(start, pos - start)));
+            }
+
+            if (pos >= data.size()) return true;
+            if (data[pos++] == '\n') return true;
+        }
+    }
+
+    // Single pass over the mapped file: fields are string_views into the buffer,
+    // numbers go through from_chars and names are interned straight into the
+    // ID tables. Station IDs are provisional until buildIntegerGraph() renumbers them.
+    // Returns false if the file cannot be read or has no usable rows.
+    bool loadFromFile(const string& filename) {
+        MappedFile file;
+
+        if (!file.open(filename)) {
+            cout << "Error opening file!" << endl;
+            return false;
+        }
+
+        rawEdges.clear();
+
+        string_view data(file.data(), file.size());
+        unordered_map<string_view, int> stationIds, lineIds;
+        vector<string_view> stationNames, lineNames;
+        deque<string> unescaped;
+        vector<string_view> fields;
+        size_t pos = 0;
+        int skipped = 0;
+
+        // Rough row estimate so the tables do not rehash while loading
+        size_t rowEstimate = data.size() / 32 + 16;
+        stationIds.reserve(rowEstimate);
+        rawEdges.reserve(rowEstimate);
+
+        auto intern = [](string_view name, unordered_map<string_view, int>& ids, vector<string_view>& names) {
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+            int id = names.size();
+            ids.emplace(name, id);
+            names.push_back(name);
+            return id;
+        };
+
+        nextCsvRecord(data, pos, fields, unescaped);  // Skip header
+
+        while (nextCsvRecord(data, pos, fields, unescaped)) {
+            if (fields.size() == 1 && fields[0].empty()) continue;  // blank line
+
+            if (fields.size() < 4) {
+                skipped++;
+                continue;
+            }
+
+            string_view station1 = trim(fields[0]);
+            string_view station2 = trim(fields[1]);
+            string_view lineColor = trim(fields[2]);
+            string_view distanceText = trim(fields[3]);
+
+            double distance;
+            auto parsed = from_chars(distanceText.data(), distanceText.data() + distanceText.size(), distance);
+            if (parsed.ec != errc() || distance < 0) {
+                skipped++;
+                continue;
+            }
+
+            if (station1.empty() || station2.empty() || station1 == station2) continue;
+
+            int from = intern(station1, stationIds, stationNames);
+            int to = intern(station2, stationIds, stationNames);
+            int lineId = intern(lineColor, lineIds, lineNames);
+            rawEdges.push_back({from, to, toMetres(distance), lineId});
+        }
+
+        // Copy the names out of the file buffer before it is unmapped
+        stations.build(stationNames);
+        lines.build(lineNames);
+
+        if (skipped > 0) {
+            cout << "Skipped " << skipped << " malformed rows in " << filename << endl;
+        }
+        if (rawEdges.empty()) {
+            cout << "No stations loaded from " << filename << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Reads Station,X,Y rows (X = longitude, Y = latitude) for the stations already
+    // in the graph. Stations missing from the file get a heuristic of 0.
+    void loadCoordinates(const string& filename) {
+        stationPoint.clear();
+        hasPoint.clear();
+        geoScale = 0;
+
+        MappedFile file;
+        if (!file.open(filename)) {
+            cout << "No coordinates loaded from " << filename << ", A* disabled" << endl;
+            return;
+        }
+
+        int n = stations.size();
+        vector<GeoPoint> points(n);
+        vector<char> known(n, 0);
+        string_view data(file.data(), file.size());
+        deque<string> unescaped;
+        vector<string_view> fields;
+        size_t pos = 0;
+
+        nextCsvRecord(data, pos, fields, unescaped);  // Skip header
+
+        while (nextCsvRecord(data, pos, fields, unescaped)) {
+            if (fields.size() < 3) continue;
+
+            int station = stations.find(trim(fields[0]));
+            string_view lonText = trim(fields[1]), latText = trim(fields[2]);
+            double lon, lat;
+            if (station == -1 ||
+                from_chars(lonText.data(), lonText.data() + lonText.size(), lon).ec != errc() ||
+                from_chars(latText.data(), latText.data() + latText.size(), lat).ec != errc()) {
+                continue;
+            }
+
+            points[station] = toGeoPoint(lon, lat);
+            known[station] = 1;
+        }
+
+        // The scale is the smallest track/chord ratio over every hop between two
+        // positioned stations: a single edge, or the shortest detour through
+        // stations without a position. Summed along a route, these hops give at
+        // least scale * chord(source, destination), so the heuristic never
+        // overestimates.
+        double scale = numeric_limits<double>::infinity();
+        auto bound = [&](int a, int b, int metres) {
+            double chord = chordMetres(points[a], points[b]);
+            if (chord > 0) scale = min(scale, metres / chord);
+        };
+
+        vector<int> dist(n, infDistance);
+        for (int a = 0; a < n; a++) {
+            if (!known[a]) continue;
+
+            // Dijkstra from a that only passes through unpositioned stations
+            vector<int> touched = {a};
+            priority_queue<pair<int,int>, vector<pair<int,int>>, greater<>> pq;
+            dist[a] = 0;
+            pq.push({0, a});
+
+            while (!pq.empty()) {
+                auto [currDist, u] = pq.top();
+                pq.pop();
+                if (currDist > dist[u]) continue;
+
+                if (u != a && known[u]) {
+                    bound(a, u, currDist);
+                    continue;
+                }
+
+                for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) {
+                    int v = edgeTo[e];
+                    int newDist = currDist + edgeWeight[e];
+                    if (newDist < dist[v]) {
+                        if (dist[v] == infDistance) touched.push_back(v);
+                        dist[v] = newDist;
+                        pq.push({newDist, v});
+                    }
+                }
+            }
+
+            for (int u : touched) dist[u] = infDistance;
+        }
+
+        int positioned = count(known.begin(), known.end(), 1);
+        if (scale == numeric_limits<double>::infinity()) {
+            cout << "Coordinates: " << positioned << " of " << n << " stations, too few for A*" << endl;
+            return;
+        }
+
+        stationPoint = move(points);
+        hasPoint = move(known);
+        geoScale = scale * (1 - 1e-9);  // margin for rounding in the products above
+        cout << "Coordinates: " << positioned << " of " << n << " stations, A* scale " << geoScale << endl;
+    }
+
+    // Reverse Cuthill-McKee: BFS from a low-degree station of every component,
+    // visiting neighbours by increasing degree, then reversed. Consecutive stations
+    // of a line end up with consecutive IDs. Returns order[newId] = oldId.
+    vector<int> reverseCuthillMcKee(const vector<vector<int>>& neighbours) {
+        int n = neighbours.size();
+        vector<int> byDegree(n);
+        for (int i = 0; i < n; i++) byDegree[i] = i;
+        stable_sort(byDegree.begin(), byDegree.end(), [&](int a, int b) {
+            return neighbours[a].size() < neighbours[b].size();
+        });
+
+        vector<int> order;
+        vector<char> visited(n, 0);
+        order.reserve(n);
+
+        for (int start : byDegree) {
+            if (visited[start]) continue;
+
+            size_t head = order.size();
+            visited[start] = 1;
+            order.push_back(start);
+
+            while (head < order.size()) {
+                int u = order[head++];
+                vector<int> next;
+                for (int v : neighbours[u]) {
+                    if (!visited[v]) {
+                        visited[v] = 1;
+                        next.push_back(v);
+                    }
+                }
+                stable_sort(next.begin(), next.end(), [&](int a, int b) {
+                    return neighbours[a].size() < neighbours[b].size();
+                });
+                order.insert(order.end(), next.begin(), next.end());
+            }
+        }
+
+        reverse(order.begin(), order.end());
+        return order;
+    }
+
+    // Largest ID gap across any edge of the current CSR graph
+    int orderingBandwidth() {
+        int bandwidth = 0;
+        for (int u = 0; u + 1 < (int)adjOffset.size(); u++) {
+            for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) {
+                bandwidth = max(bandwidth, abs(edgeTo[e] - u));
+            }
+        }
+        return bandwidth;
+    }
+
+    void buildIntegerGraph() {
+        int stationId = stations.size();
+
+        // Provisional IDs are in file order, only used to compute the final ordering
+        vector<vector<int>> neighbours(stationId);
+        int provisionalBandwidth = 0;
+        for (auto& edge : rawEdges) {
+            neighbours[edge.from].push_back(edge.to);
+            neighbours[edge.to].push_back(edge.from);
+            provisionalBandwidth = max(provisionalBandwidth, abs(edge.to - edge.from));
+        }
+        for (auto& list : neighbours) {
+            sort(list.begin(), list.end());
+            list.erase(unique(list.begin(), list.end()), list.end());
+        }
+
+        // Renumber so that neighbouring stations get neighbouring IDs
+        vector<int> order = reverseCuthillMcKee(neighbours);
+        vector<int> newId(stationId);
+        vector<string_view> renamed(stationId);
+        for (int id = 0; id < stationId; id++) {
+            newId[order[id]] = id;
+            renamed[id] = stations.name(order[id]);
+        }
+        NameTable ordered;
+        ordered.build(renamed);
+        stations = move(ordered);
+
+        // First pass: degree of every station, prefix-summed into offsets
+        vector<int> offset(stationId + 1, 0);
+        for (auto& edge : rawEdges) {
+            offset[newId[edge.from] + 1]++;
+            offset[newId[edge.to] + 1]++;
+        }
+        for (int i = 0; i < stationId; i++) {
+            offset[i + 1] += offset[i];
+        }
+
+        // Second pass: write both directions of every row into the contiguous edge block
+        vector<int> to(offset[stationId]), weight(offset[stationId]), line(offset[stationId]);
+        vector<int> cursor(offset.begin(), offset.end() - 1);
+
+        for (auto& edge : rawEdges) {
+            int a = newId[edge.from], b = newId[edge.to];
+
+            int slot = cursor[a]++;
+            to[slot] = b;
+            weight[slot] = edge.metres;
+            line[slot] = edge.lineId;
+
+            slot = cursor[b]++;
+            to[slot] = a;
+            weight[slot] = edge.metres;
+            line[slot] = edge.lineId;
+        }
+
+        adjOffset.assign(move(offset));
+        edgeTo.assign(move(to));
+        edgeWeight.assign(move(weight));
+        edgeLine.assign(move(line));
+
+        cout << "Station ordering: reverse Cuthill-McKee, bandwidth " << orderingBandwidth()
+             << " (file order: " << provisionalBandwidth << ")" << endl;
+        rawEdges.clear();
+        rawEdges.shrink_to_fit();
+
+        buildIndexes();
+    }
+
+    // Structures derived from the CSR graph, rebuilt whenever the graph is (re)loaded
+    void buildIndexes() {
+        buildComponents();
+        buildOverlay();
+        if (useContractionHierarchy && hierarchy.empty()) buildContractionHierarchy();
+        if (hubLabels.empty() && hubLabelMaxStations > 0 && (size_t)stations.size() <= hubLabelMaxStations) buildHubLabels();
+        if (landmarks.empty() && altLandmarkCount > 0) buildLandmarks();
+        buildLineStates();
+        buildLineGraph();
+        buildRoutingTable();
+        buildTransferPatterns();
+    }
+
+    // One full search per destination, spread over all cores. The graph is
+    // undirected and exchange counts are symmetric, so the search tree rooted at
+    // t gives every station's next hop toward t.
+    void buildRoutingTable() {
+        routingTable = RoutingTable();
+        int n = stations.size();
+        int states = lineStates.line.size();
+        size_t bytes = ((size_t)n * n * 5 + (size_t)n * states) * sizeof(int);
+        if (n == 0 || bytes > routingTableMaxBytes) return;
+
+        auto start = chrono::steady_clock::now();
+
+        RoutingTable table;
+        table.dist.resize((size_t)n * n);
+        table.next.resize((size_t)n * n);
+        table.changes.resize((size_t)n * n);
+        table.exchangeDist.resize((size_t)n * n);
+        table.firstState.resize((size_t)n * n);
+        table.nextState.resize((size_t)n * states);
+
+        atomic<int> nextTarget(0);
+        auto worker = [&]() {
+            SearchLabels labels;
+            for (int t = nextTarget++; t < n; t = nextTarget++) {
+                size_t row = (size_t)t * n;
+
+                dijkstraSearch(t, -1, labels);
+                for (int s = 0; s < n; s++) {
+                    table.dist[row + s] = labels.dist(s);
+                    table.next[row + s] = labels.reached(s) ? labels[s].parent : -1;
+                }
+
+                exchangeSearch(t, -1, labels);
+                for (int k = 0; k < states; k++) {
+                    table.nextState[(size_t)t * states + k] = labels.reached(k) ? labels[k].parent : -1;
+                }
+
+                for (int s = 0; s < n; s++) {
+                    int bestState = bestExchangeState(s, labels);
+                    table.firstState[row + s] = bestState;
+                    table.changes[row + s] = bestState == -1 ? INT_MAX : labels[bestState].tag;
+                    table.exchangeDist[row + s] = bestState == -1 ? infDistance : labels[bestState].dist;
+                }
+            }
+        };
+
+        int threads = max(1u, thread::hardware_concurrency());
+        vector<thread> pool;
+        for (int i = 1; i < threads; i++) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+
+        routingTable = move(table);
+
+        auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Routing table: " << n << " stations, " << bytes / 1024 << " KB in " << elapsed
+             << " ms (" << threads << " threads)" << endl;
+    }
+
+    // Along-line distances come from one search per stop over that line's own
+    // edges, since lines may branch or loop. Patterns come from one exchange
+    // search per source, spread over all cores like the routing table.
+    void buildTransferPatterns() {
+        patterns = TransferPatterns();
+        int n = stations.size();
+        if (n == 0 || transferPatternMaxStations == 0 || (size_t)n > transferPatternMaxStations) return;
+
+        auto start = chrono::steady_clock::now();
+        const LineStates& ls = lineStates;
+        int lineCount = lines.size();
+        int states = ls.line.size();
+        TransferPatterns tp;
+
+        // States are ordered by station; bucket them by line instead
+        tp.lineOffset.assign(lineCount + 1, 0);
+        for (int k = 0; k < states; k++) tp.lineOffset[ls.line[k] + 1]++;
+        for (int l = 0; l < lineCount; l++) tp.lineOffset[l + 1] += tp.lineOffset[l];
+        tp.lineStation.resize(states);
+        tp.stateIndex.resize(states);
+        vector<int> fill(tp.lineOffset.begin(), tp.lineOffset.end() - 1);
+        for (int k = 0; k < states; k++) {
+            int l = ls.line[k];
+            tp.stateIndex[k] = fill[l] - tp.lineOffset[l];
+            tp.lineStation[fill[l]++] = ls.station[k];
+        }
+
+        tp.matrixOffset.assign(lineCount + 1, 0);
+        for (int l = 0; l < lineCount; l++) {
+            size_t size = tp.lineOffset[l + 1] - tp.lineOffset[l];
+            tp.matrixOffset[l + 1] = tp.matrixOffset[l] + size * size;
+        }
+        tp.lineDist.assign(tp.matrixOffset[lineCount], infDistance);
+        tp.lineNext.assign(tp.matrixOffset[lineCount], -1);
+
+        BinaryHeap<int> heap;
+        for (int l = 0; l < lineCount; l++) {
+            int size = tp.lineOffset[l + 1] - tp.lineOffset[l];
+            for (int i = 0; i < size; i++) {
+                int* row = &tp.lineDist[tp.matrixOffset[l] + (size_t)i * size];
+                int* next = &tp.lineNext[tp.matrixOffset[l] + (size_t)i * size];
+                row[i] = 0;
+                heap.clear();
+                heap.push(0, i);
+                while (!heap.empty()) {
+                    auto [d, j] = heap.pop();
+                    if (d > row[j]) continue;
+                    int u = tp.lineStation[tp.lineOffset[l] + j];
+                    for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) {
+                        if (edgeLine[e] != l) continue;
+                        int v = tp.stateIndex[ls.edgeState[e]];
+                        if (d + edgeWeight[e] < row[v]) {
+                            row[v] = d + edgeWeight[e];
+                            next[v] = j;
+                            heap.push(row[v], v);
+                        }
+                    }
+                }
+            }
+        }
+
+        vector<vector<int>> sourceParent(n), sourceBoard(n);
+        tp.lastLeg.assign((size_t)n * n, TransferPatterns::noLeg);
+        atomic<bool> overflow(false);
+
+        atomic<int> nextSource(0);
+        auto worker = [&]() {
+            SearchLabels labels;
+            vector<int> hops;
+            unordered_map<uint64_t, int> trie;  // (previous leg + 1, boarded state) -> leg
+            for (int s = nextSource++; s < n; s = nextSource++) {
+                exchangeSearch(s, -1, labels);
+                trie.clear();
+                vector<int>& nodeParent = sourceParent[s];
+                vector<int>& nodeBoard = sourceBoard[s];
+
+                for (int t = 0; t < n; t++) {
+                    int bestState = bestExchangeState(t, labels);
+                    if (t == s || bestState == -1) continue;
+
+                    // A state's line is the one ridden into it; a leg starts
+                    // wherever that line differs from the previous hop's
+                    hops.clear();
+                    for (int k = bestState; labels[k].parent != -1; k = labels[k].parent) hops.push_back(k);
+
+                    int node = -1;
+                    for (int h = hops.size() - 1; h >= 0; h--) {
+                        bool first = h + 1 == (int)hops.size();
+                        if (!first && ls.line[hops[h + 1]] == ls.line[hops[h]]) continue;
+
+                        int board = stateOf(first ? s : ls.station[hops[h + 1]], ls.line[hops[h]]);
+                        auto [it, inserted] = trie.emplace((uint64_t)(node + 1) << 32 | board, nodeParent.size());
+                        if (inserted) {
+                            nodeParent.push_back(node);
+                            nodeBoard.push_back(board);
+                        }
+                        node = it->second;
+                    }
+                    if (node >= TransferPatterns::noLeg) overflow = true;
+                    else tp.lastLeg[(size_t)s * n + t] = node;
+                }
+            }
+        };
+
+        int threads = max(1u, thread::hardware_concurrency());
+        vector<thread> pool;
+        for (int i = 1; i < threads; i++) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+
+        if (overflow) {
+            cout << "Transfer patterns: a source needs more than " << TransferPatterns::noLeg
+                 << " legs, /min_exchanges falls back to search" << endl;
+            return;
+        }
+
+        tp.nodeOffset.assign(n + 1, 0);
+        for (int s = 0; s < n; s++) {
+            tp.nodeOffset[s + 1] = tp.nodeOffset[s] + sourceParent[s].size();
+            tp.nodeParent.insert(tp.nodeParent.end(), sourceParent[s].begin(), sourceParent[s].end());
+            tp.nodeBoard.insert(tp.nodeBoard.end(), sourceBoard[s].begin(), sourceBoard[s].end());
+        }
+
+        size_t nodes = tp.nodeParent.size();
+        size_t patternBytes = (nodes * 2 + tp.nodeOffset.size()) * sizeof(int) + tp.lastLeg.size() * sizeof(uint16_t);
+        size_t lineBytes = (tp.lineStation.size() + tp.stateIndex.size() + tp.lineDist.size() + tp.lineNext.size()) * sizeof(int);
+        patterns = move(tp);
+
+        auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Transfer patterns: " << nodes << " legs (" << (double)nodes / n << " per source), "
+             << patternBytes / 1024 << " KB + " << lineBytes / 1024 << " KB of along-line rides in "
+             << elapsed << " ms (" << threads << " threads)" << endl;
+    }
+
+    // State of station u with the fewest changes, then metres, after an
+    // exchange search; -1 if no state of u was reached
+    int bestExchangeState(int u, const SearchLabels& labels) const {
+        int best = -1;
+        for (int k = lineStates.offset[u]; k < lineStates.offset[u + 1]; k++) {
+            if (!labels.reached(k)) continue;
+            if (best == -1 || exchangeKey(labels[k].tag, labels[k].dist) < exchangeKey(labels[best].tag, labels[best].dist))
+                best = k;
+        }
+        return best;
+    }
+
+    // State of (u, line), or -1 if the line does not serve u
+    int stateOf(int u, int line) const {
+        const LineStates& ls = lineStates;
+        auto first = ls.line.begin() + ls.offset[u], last = ls.line.begin() + ls.offset[u + 1];
+        auto it = lower_bound(first, last, line);
+        return it != last && *it == line ? it - ls.line.begin() : -1;
+    }
+
+    // Components are labelled by BFS so unreachable pairs are rejected before any search
+    void buildComponents() {
+        int n = stations.size();
+        componentOf.assign(n, -1);
+        componentSize.clear();
+
+        vector<int> queue;
+        for (int start = 0; start < n; start++) {
+            if (componentOf[start] != -1) continue;
+
+            int id = componentSize.size();
+            componentOf[start] = id;
+            queue.assign(1, start);
+
+            for (size_t head = 0; head < queue.size(); head++) {
+                int u = queue[head];
+                for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) {
+                    if (componentOf[edgeTo[e]] == -1) {
+                        componentOf[edgeTo[e]] = id;
+                        queue.push_back(edgeTo[e]);
+                    }
+                }
+            }
+            componentSize.push_back(queue.size());
+        }
+
+        cout << "Components: " << componentSize.size() << endl;
+    }
+
+    bool connected(int a, int b) const {
+        return componentOf[a] == componentOf[b];
+    }
+
+    // Diagnostic summary for /health: graph size and its components, largest first
+    json healthReport(size_t maxComponents = 50) {
+        json report;
+        report["status"] = "ok";
+        report["stations"] = stations.size();
+        report["edges"] = edgeTo.size() / 2;
+        report["lines"] = lines.size();
+        report["component_count"] = componentSize.size();
+
+        vector<int> order(componentSize.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        sort(order.begin(), order.end(), [&](int a, int b) {
+            return componentSize[a] != componentSize[b] ? componentSize[a] > componentSize[b] : a < b;
+        });
+        if (order.size() > maxComponents) order.resize(maxComponents);
+
+        // One example station per listed component
+        vector<int> example(componentSize.size(), -1);
+        for (int u = stations.size() - 1; u >= 0; u--) example[componentOf[u]] = u;
+
+        json components = json::array();
+        for (int c : order) {
+            components.push_back({{"id", c}, {"stations", componentSize[c]},
+                                  {"example", stations.name(example[c])}});
+        }
+        report["components"] = components;
+
+        json engines;
+        for (int i = EngineAuto + 1; i < EngineCount; i++) {
+            uint64_t queries = engineStats[i].queries, settled = engineStats[i].settled;
+            uint64_t reachable = engineStats[i].reachable;
+            engines[engineNames[i]] = {{"queries", queries}, {"settled_nodes", settled},
+                                       {"avg_settled_nodes", queries ? (double)settled / queries : 0.0},
+                                       {"pruning_ratio", reachable ? 1 - (double)settled / reachable : 0.0}};
+        }
+        report["default_engine"] = shortestPathEngine;
+        report["astar_available"] = geoScale > 0;
+        if (!hubLabels.empty()) {
+            report["hub_label_entries"] = hubLabels.hub.size();
+            report["hub_labels_per_station"] = (double)hubLabels.hub.size() / stations.size();
+        }
+        report["alt_landmarks"] = landmarks.count();
+        if (!patterns.empty()) report["transfer_pattern_legs"] = patterns.nodeParent.size();
+        {
+            lock_guard<mutex> lock(sourceTreeMutex);
+            report["source_trees"] = {{"cached", sourceTrees.trees.size()}, {"hits", sourceTrees.hits},
+                                      {"builds", sourceTrees.builds}};
+        }
+        report["engines"] = engines;
+        return report;
+    }
+
+    void buildLineStates() {
+        int n = stations.size();
+        LineStates ls;
+        ls.offset.assign(n + 1, 0);
+
+        for (int u = 0; u < n; u++) {
+            vector<int> served;
+            for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) served.push_back(edgeLine[e]);
+            sort(served.begin(), served.end());
+            served.erase(unique(served.begin(), served.end()), served.end());
+
+            for (int line : served) {
+                ls.line.push_back(line);
+                ls.station.push_back(u);
+            }
+            ls.offset[u + 1] = ls.line.size();
+        }
+
+        // Locate (v, line) among the few states of v
+        ls.edgeState.resize(edgeTo.size());
+        for (size_t e = 0; e < edgeTo.size(); e++) {
+            int v = edgeTo[e];
+            auto first = ls.line.begin() + ls.offset[v], last = ls.line.begin() + ls.offset[v + 1];
+            ls.edgeState[e] = lower_bound(first, last, edgeLine[e]) - ls.line.begin();
+        }
+
+        lineStates = move(ls);
+    }
+
+    void buildLineGraph() {
+        const LineStates& ls = lineStates;
+        int states = ls.line.size();
+        LineGraph graph;
+
+        // Pieces are the connected stretches of each line: join the two states
+        // at the ends of every edge, then number the roots
+        vector<int> root(states);
+        for (int k = 0; k < states; k++) root[k] = k;
+        auto find = [&](int k) {
+            while (root[k] != k) k = root[k] = root[root[k]];
+            return k;
+        };
+        for (int u = 0; u < (int)stations.size(); u++) {
+            for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) {
+                root[find(stateOf(u, edgeLine[e]))] = find(ls.edgeState[e]);
+            }
+        }
+
+        graph.statePiece.assign(states, -1);
+        for (int k = 0; k < states; k++) {
+            int r = find(k);
+            if (graph.statePiece[r] == -1) {
+                graph.statePiece[r] = graph.pieceLine.size();
+                graph.pieceLine.push_back(ls.line[k]);
+            }
+            graph.statePiece[k] = graph.statePiece[r];
+        }
+
+        // Every pair of pieces meeting at a station is linked
+        int pieces = graph.pieceLine.size();
+        vector<vector<int>> neighbours(pieces);
+        for (int u = 0; u < (int)stations.size(); u++) {
+            for (int a = ls.offset[u]; a < ls.offset[u + 1]; a++) {
+                for (int b = ls.offset[u]; b < ls.offset[u + 1]; b++) {
+                    if (a != b) neighbours[graph.statePiece[a]].push_back(graph.statePiece[b]);
+                }
+            }
+        }
+
+        graph.offset.assign(1, 0);
+        for (auto& list : neighbours) {
+            sort(list.begin(), list.end());
+            list.erase(unique(list.begin(), list.end()), list.end());
+            graph.adjacent.insert(graph.adjacent.end(), list.begin(), list.end());
+            graph.offset.push_back(graph.adjacent.size());
+        }
+
+        cout << "Line graph: " << pieces << " pieces of " << lines.size() << " lines, "
+             << graph.adjacent.size() / 2 << " links" << endl;
+        lineGraph = move(graph);
+    }
+
+    // Contracts stations one at a time, least important first, adding a shortcut
+    // between two neighbours whenever the route through the contracted station
+    // may be their only shortest one. Importance is the edge difference (shortcuts
+    // added minus edges removed) plus the number of neighbours already contracted,
+    // which spreads contraction evenly; it is refreshed lazily when popped.
+    void buildContractionHierarchy() {
+        auto start = chrono::steady_clock::now();
+        int n = stations.size();
+
+        struct Arc {
+            int to;
+            int weight;
+            int middle;
+        };
+        vector<vector<Arc>> adj(n);
+
+        // Keeps one arc per neighbour, the shortest
+        auto addArc = [&](int u, int v, int weight, int middle) {
+            for (Arc& arc : adj[u]) {
+                if (arc.to == v) {
+                    if (weight < arc.weight) arc = {v, weight, middle};
+                    return;
+                }
+            }
+            adj[u].push_back({v, weight, middle});
+        };
+
+        for (int u = 0; u < n; u++) {
+            for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) addArc(u, edgeTo[e], edgeWeight[e], -1);
+        }
+
+        // Witness search: Dijkstra from source avoiding skip, bounded by metres,
+        // by settleLimit and by settling every target. Labels stay in witnessDist
+        // until reset.
+        vector<int> witnessDist(n, infDistance);
+        vector<char> isTarget(n, 0);
+        vector<int> touched;
+        vector<pair<int,int>> heap;  // reused across searches; there are millions of them
+        auto witnessSearch = [&](int source, int skip, int limit, int targets, int settleLimit) {
+            heap.clear();
+            witnessDist[source] = 0;
+            touched.push_back(source);
+            heap.push_back({0, source});
+            int settled = 0;
+
+            while (!heap.empty() && settled < settleLimit && targets > 0) {
+                pop_heap(heap.begin(), heap.end(), greater<>());
+                auto [currDist, u] = heap.back();
+                heap.pop_back();
+                if (currDist > witnessDist[u]) continue;
+                if (currDist > limit) break;
+                settled++;
+                if (isTarget[u]) targets--;
+
+                for (const Arc& arc : adj[u]) {
+                    if (arc.to == skip) continue;
+                    int newDist = currDist + arc.weight;
+                    if (newDist < witnessDist[arc.to]) {
+                        if (witnessDist[arc.to] == infDistance) touched.push_back(arc.to);
+                        witnessDist[arc.to] = newDist;
+                        heap.push_back({newDist, arc.to});
+                        push_heap(heap.begin(), heap.end(), greater<>());
+                    }
+                }
+            }
+        };
+
+        // Shortcuts needed to contract v; added to adj when apply is set. Ordering
+        // only needs an estimate, so it searches with a tighter settle limit.
+        auto contract = [&](int v, bool apply) {
+            vector<Arc> neighbours = adj[v];
+            int shortcuts = 0;
+
+            for (size_t i = 0; i + 1 < neighbours.size(); i++) {
+                int limit = 0;
+                for (size_t j = i + 1; j < neighbours.size(); j++) {
+                    limit = max(limit, neighbours[i].weight + neighbours[j].weight);
+                    isTarget[neighbours[j].to] = 1;
+                }
+
+                witnessSearch(neighbours[i].to, v, limit, neighbours.size() - i - 1,
+                              apply ? witnessSettleLimit : witnessSettleLimit / 10);
+                for (size_t j = i + 1; j < neighbours.size(); j++) isTarget[neighbours[j].to] = 0;
+
+                for (size_t j = i + 1; j < neighbours.size(); j++) {
+                    int via = neighbours[i].weight + neighbours[j].weight;
+                    if (witnessDist[neighbours[j].to] <= via) continue;
+
+                    shortcuts++;
+                    if (apply) {
+                        addArc(neighbours[i].to, neighbours[j].to, via, v);
+                        addArc(neighbours[j].to, neighbours[i].to, via, v);
+                    }
+                }
+
+                for (int u : touched) witnessDist[u] = infDistance;
+                touched.clear();
+            }
+            return shortcuts;
+        };
+
+        vector<int> contractedNeighbours(n, 0);
+        auto priority = [&](int v) {
+            return contract(v, false) - (int)adj[v].size() + contractedNeighbours[v];
+        };
+
+        priority_queue<pair<int,int>, vector<pair<int,int>>, greater<>> queue;
+        for (int v = 0; v < n; v++) queue.push({priority(v), v});
+
+        vector<int> rank(n, -1);
+        vector<int> offset = {0}, to, weight, middle;
+        int shortcutCount = 0;
+
+        while (!queue.empty()) {
+            int v = queue.top().second;
+            queue.pop();
+            if (rank[v] != -1) continue;
+
+            int current = priority(v);
+            if (!queue.empty() && current > queue.top().first) {
+                queue.push({current, v});
+                continue;
+            }
+
+            // Every arc left at v leads to a higher rank: they are v's upward edges
+            rank[v] = offset.size() - 1;
+            for (const Arc& arc : adj[v]) {
+                to.push_back(arc.to);
+                weight.push_back(arc.weight);
+                middle.push_back(arc.middle);
+                if (arc.middle != -1) shortcutCount++;
+            }
+            offset.push_back(to.size());
+
+            contract(v, true);
+            for (const Arc& arc : adj[v]) {
+                vector<Arc>& back = adj[arc.to];
+                back.erase(remove_if(back.begin(), back.end(), [&](const Arc& a) { return a.to == v; }), back.end());
+                contractedNeighbours[arc.to]++;
+            }
+            vector<Arc>().swap(adj[v]);
+        }
+
+        hierarchy.rank.assign(move(rank));
+        hierarchy.offset.assign(move(offset));
+        hierarchy.to.assign(move(to));
+        hierarchy.weight.assign(move(weight));
+        hierarchy.middle.assign(move(middle));
+
+        auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Contraction hierarchy: " << hierarchy.to.size() << " upward edges (" << shortcutCount
+             << " shortcuts) in " << elapsed << " ms" << endl;
+    }
+
+    // Pruned landmark labeling: a Dijkstra from every station in importance
+    // order, which labels a station only when the labels so far cannot already
+    // prove its distance, and does not expand past it otherwise. Importance is the
+    // contraction order when a hierarchy exists (highest rank first), degree otherwise.
+    void buildHubLabels() {
+        auto start = chrono::steady_clock::now();
+        int n = stations.size();
+
+        vector<int> order(n);
+        for (int u = 0; u < n; u++) order[u] = u;
+        if (!hierarchy.empty()) {
+            sort(order.begin(), order.end(), [&](int a, int b) { return hierarchy.rank[a] > hierarchy.rank[b]; });
+        } else {
+            stable_sort(order.begin(), order.end(), [&](int a, int b) {
+                return adjOffset[a + 1] - adjOffset[a] > adjOffset[b + 1] - adjOffset[b];
+            });
+        }
+
+        struct Entry {
+            int hub;
+            int dist;
+            int parent;
+        };
+        vector<vector<Entry>> labels(n);
+
+        vector<int> hubDist(n, infDistance);  // hub index -> metres from the current root
+        vector<int> dist(n, infDistance), parent(n, -1), touched;
+        RadixHeap<uint32_t> pq;
+
+        for (int k = 0; k < n; k++) {
+            int root = order[k];
+            for (const Entry& entry : labels[root]) hubDist[entry.hub] = entry.dist;
+
+            pq.clear();
+            dist[root] = 0;
+            touched.push_back(root);
+            pq.push(0, root);
+
+            while (!pq.empty()) {
+                auto [key, u] = pq.pop();
+                int currDist = key;
+                if (currDist > dist[u]) continue;
+
+                bool covered = false;
+                for (const Entry& entry : labels[u]) {
+                    if (hubDist[entry.hub] != infDistance && hubDist[entry.hub] + entry.dist <= currDist) {
+                        covered = true;
+                        break;
+                    }
+                }
+                if (covered) continue;
+
+                labels[u].push_back({k, currDist, parent[u]});
+
+                for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) {
+                    int v = edgeTo[e];
+                    int newDist = currDist + edgeWeight[e];
+                    if (newDist < dist[v]) {
+                        if (dist[v] == infDistance) touched.push_back(v);
+                        dist[v] = newDist;
+                        parent[v] = u;
+                        pq.push(newDist, v);
+                    }
+                }
+            }
+
+            for (int u : touched) {
+                dist[u] = infDistance;
+                parent[u] = -1;
+            }
+            touched.clear();
+            for (const Entry& entry : labels[root]) hubDist[entry.hub] = infDistance;
+        }
+
+        vector<int> offset = {0}, hub, hubDistance, hubParent;
+        for (int u = 0; u < n; u++) {
+            for (const Entry& entry : labels[u]) {
+                hub.push_back(entry.hub);
+                hubDistance.push_back(entry.dist);
+                hubParent.push_back(entry.parent);
+            }
+            offset.push_back(hub.size());
+            vector<Entry>().swap(labels[u]);
+        }
+
+        hubLabels.order.assign(move(order));
+        hubLabels.offset.assign(move(offset));
+        hubLabels.hub.assign(move(hub));
+        hubLabels.dist.assign(move(hubDistance));
+        hubLabels.parent.assign(move(hubParent));
+
+        size_t entries = hubLabels.hub.size();
+        auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Hub labels: " << entries << " entries, " << (double)entries / max(n, 1) << " per station, "
+             << entries * 3 * sizeof(int) / 1024 << " KB in " << elapsed << " ms" << endl;
+    }
+
+    // Farthest-point selection: each landmark is the station farthest from every
+    // landmark chosen so far (a station no landmark reaches counts as farthest, so
+    // each component gets one), starting from the station farthest from station 0.
+    void buildLandmarks() {
+        auto start = chrono::steady_clock::now();
+        int n = stations.size();
+        int k = min(altLandmarkCount, n);
+        if (k <= 0) return;
+
+        vector<int> chosen, table((size_t)n * k);
+        vector<long long> nearest(n, numeric_limits<long long>::max());
+        SearchLabels labels;
+
+        dijkstraSearch(0, -1, labels);
+        int next = 0;
+        for (int u = 0; u < n; u++) {
+            if (labels.reached(u) && labels[u].dist > labels[next].dist) next = u;
+        }
+
+        for (int i = 0; i < k; i++) {
+            chosen.push_back(next);
+            dijkstraSearch(next, -1, labels);
+
+            for (int u = 0; u < n; u++) {
+                table[(size_t)u * k + i] = labels.dist(u);
+                if (labels.reached(u)) nearest[u] = min(nearest[u], (long long)labels[u].dist);
+            }
+            next = max_element(nearest.begin(), nearest.end()) - nearest.begin();
+        }
+
+        landmarks.station.assign(move(chosen));
+        landmarks.dist.assign(move(table));
+
+        auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "ALT landmarks: " << k << " (" << (size_t)n * k * sizeof(int) / 1024 << " KB) in "
+             << elapsed << " ms" << endl;
+    }
+
+    void buildOverlay() {
+        int n = stations.size();
+        ChainOverlay ov;
+
+        // Distinct neighbours with the cheapest parallel edge
+        vector<vector<pair<int,int>>> neighbours(n);
+        for (int u = 0; u < n; u++) {
+            auto& list = neighbours[u];
+            for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) list.push_back({edgeTo[e], edgeWeight[e]});
+            sort(list.begin(), list.end());
+            list.erase(unique(list.begin(), list.end(), [](auto& a, auto& b) { return a.first == b.first; }),
+                       list.end());
+        }
+
+        ov.nodeOf.assign(n, -1);
+        ov.chainOf.assign(n, -1);
+        ov.chainPos.assign(n, -1);
+        ov.chainOffset = {0};
+
+        auto promote = [&](int u) {
+            ov.nodeOf[u] = ov.node.size();
+            ov.node.push_back(u);
+        };
+
+        // Walks from overlay node a through neighbour k until the next overlay node
+        auto walk = [&](int a, int k) {
+            int prev = a, cur = neighbours[a][k].first, d = neighbours[a][k].second;
+            if (ov.nodeOf[cur] == -1 && ov.chainOf[cur] != -1) return;  // walked from the other end
+            if (ov.nodeOf[cur] != -1 && cur < a) return;                 // direct edge, kept once
+
+            int c = ov.chainOffset.size() - 1;
+            ov.chainStations.push_back(a);
+            ov.chainDist.push_back(0);
+
+            while (ov.nodeOf[cur] == -1) {
+                ov.chainOf[cur] = c;
+                ov.chainPos[cur] = ov.chainStations.size() - ov.chainOffset[c];
+                ov.chainStations.push_back(cur);
+                ov.chainDist.push_back(d);
+
+                auto& next = neighbours[cur][neighbours[cur][0].first == prev ? 1 : 0];
+                prev = cur;
+                cur = next.first;
+                d += next.second;
+            }
+
+            ov.chainStations.push_back(cur);
+            ov.chainDist.push_back(d);
+            ov.chainOffset.push_back(ov.chainStations.size());
+        };
+
+        for (int u = 0; u < n; u++) {
+            if (neighbours[u].size() != 2) promote(u);
+        }
+        for (size_t i = 0; i < ov.node.size(); i++) {
+            for (size_t k = 0; k < neighbours[ov.node[i]].size(); k++) walk(ov.node[i], k);
+        }
+
+        // Rings without any interchange: promote one station and walk around
+        for (int u = 0; u < n; u++) {
+            if (ov.nodeOf[u] == -1 && ov.chainOf[u] == -1) {
+                promote(u);
+                walk(u, 0);
+            }
+        }
+
+        // Overlay CSR: both directions of every chain, loops dropped
+        int chains = ov.chainOffset.size() - 1;
+        vector<array<int,4>> edges;  // from, to, weight, chain
+        for (int c = 0; c < chains; c++) {
+            int first = ov.chainOffset[c], last = ov.chainOffset[c + 1] - 1;
+            int a = ov.nodeOf[ov.chainStations[first]], b = ov.nodeOf[ov.chainStations[last]];
+            if (a == b) continue;
+            edges.push_back({a, b, ov.chainDist[last], c});
+            edges.push_back({b, a, ov.chainDist[last], ~c});
+        }
+        sort(edges.begin(), edges.end());
+
+        int nodes = ov.node.size();
+        ov.offset.assign(nodes + 1, 0);
+        for (auto& edge : edges) {
+            ov.offset[edge[0] + 1]++;
+            ov.to.push_back(edge[1]);
+            ov.weight.push_back(edge[2]);
+            ov.chain.push_back(edge[3]);
+        }
+        for (int i = 0; i < nodes; i++) ov.offset[i + 1] += ov.offset[i];
+
+        overlay = move(ov);
+        cout << "Chain overlay: " << nodes << " nodes, " << edges.size() << " edges, "
+             << chains << " chains (graph: " << n << " stations, " << edgeTo.size() << " edges)" << endl;
+    }
+
+    bool saveSnapshot(const string& filename) {
+        vector<pair<uint32_t, string>> sections;
+
+        auto addArray = [&](uint32_t tag, const void* data, size_t bytes) {
+            sections.push_back({tag, string(static_cast<const char*>(data), bytes)});
+        };
+
+        auto addNames = [&](uint32_t offsetTag, uint32_t poolTag, uint32_t slotTag, const NameTable& names) {
+            addArray(offsetTag, names.offset.data(), names.offset.size() * sizeof(uint32_t));
+            addArray(poolTag, names.pool.data(), names.pool.size());
+            addArray(slotTag, names.slots.data(), names.slots.size() * sizeof(int));
+        };
+
+        addNames(SECTION_STATION_OFFSETS, SECTION_STATION_POOL, SECTION_STATION_SLOTS, stations);
+        addNames(SECTION_LINE_OFFSETS, SECTION_LINE_POOL, SECTION_LINE_SLOTS, lines);
+        addArray(SECTION_ADJ_OFFSET, adjOffset.data(), adjOffset.size() * sizeof(int));
+        addArray(SECTION_EDGE_TO, edgeTo.data(), edgeTo.size() * sizeof(int));
+        addArray(SECTION_EDGE_WEIGHT, edgeWeight.data(), edgeWeight.size() * sizeof(int));
+        addArray(SECTION_EDGE_LINE, edgeLine.data(), edgeLine.size() * sizeof(int));
+        if (!hierarchy.empty()) {
+            addArray(SECTION_CH_RANK, hierarchy.rank.data(), hierarchy.rank.size() * sizeof(int));
+            addArray(SECTION_CH_OFFSET, hierarchy.offset.data(), hierarchy.offset.size() * sizeof(int));
+            addArray(SECTION_CH_TO, hierarchy.to.data(), hierarchy.to.size() * sizeof(int));
+            addArray(SECTION_CH_WEIGHT, hierarchy.weight.data(), hierarchy.weight.size() * sizeof(int));
+            addArray(SECTION_CH_MIDDLE, hierarchy.middle.data(), hierarchy.middle.size() * sizeof(int));
+        }
+        if (!hubLabels.empty()) {
+            addArray(SECTION_HUB_ORDER, hubLabels.order.data(), hubLabels.order.size() * sizeof(int));
+            addArray(SECTION_HUB_OFFSET, hubLabels.offset.data(), hubLabels.offset.size() * sizeof(int));
+            addArray(SECTION_HUB_INDEX, hubLabels.hub.data(), hubLabels.hub.size() * sizeof(int));
+            addArray(SECTION_HUB_DIST, hubLabels.dist.data(), hubLabels.dist.size() * sizeof(int));
+            addArray(SECTION_HUB_PARENT, hubLabels.parent.data(), hubLabels.parent.size() * sizeof(int));
+        }
+        if (!landmarks.empty()) {
+            addArray(SECTION_ALT_LANDMARKS, landmarks.station.data(), landmarks.station.size() * sizeof(int));
+            addArray(SECTION_ALT_DIST, landmarks.dist.data(), landmarks.dist.size() * sizeof(int));
+        }
+
+        auto align8 = [](uint64_t x) { return (x + 7) & ~uint64_t(7); };
+
+        SnapshotHeader header = {};
+        memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+        header.version = snapshotVersion;
+        header.byteOrder = byteOrderMark;
+        header.sectionCount = sections.size();
+
+        vector<SnapshotSectionEntry> directory;
+        uint64_t offset = align8(sizeof(SnapshotHeader) + sections.size() * sizeof(SnapshotSectionEntry));
+        for (auto& section : sections) {
+            directory.push_back({section.first, 0, offset, section.second.size()});
+            offset = align8(offset + section.second.size());
+        }
+
+        // Written beside the target and renamed over it: a server mapping the
+        // old file keeps its inode, and the path never shows a partial file
+        string temporary = filename + ".tmp";
+        ofstream file(temporary, ios::binary | ios::trunc);
+        if (!file.is_open()) {
+            cout << "Error writing snapshot " << temporary << endl;
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(directory.data()), directory.size() * sizeof(SnapshotSectionEntry));
+        for (size_t i = 0; i < sections.size(); i++) {
+            string padding(directory[i].offset - (uint64_t)file.tellp(), '\0');
+            file.write(padding.data(), padding.size());
+            file.write(sections[i].second.data(), sections[i].second.size());
+        }
+        file.flush();
+        bool written = file.good();
+        file.close();
+
+        error_code error;
+        if (written) filesystem::rename(temporary, filename, error);
+        if (!written || error) {
+            cout << "Error writing snapshot " << filename << endl;
+            filesystem::remove(temporary, error);
+            return false;
+        }
+        return true;
+    }
+
+    // Maps a snapshot written by saveSnapshot(). Every array, including the name
+    // arenas and their hash tables, is used in place: loading is O(1) in graph size.
+    bool loadSnapshot(const string& filename) {
+        auto start = chrono::steady_clock::now();
+
+        if (!snapshot.open(filename)) {
+            cout << "Error opening snapshot " << filename << endl;
+            return false;
+        }
+
+        const char* base = snapshot.data();
+        size_t length = snapshot.size();
+
+        SnapshotHeader header;
+        if (length < sizeof(header)) return rejectSnapshot("truncated header");
+        memcpy(&header, base, sizeof(header));
+
+        if (memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0) return rejectSnapshot("bad magic");
+        if (header.byteOrder != byteOrderMark) return rejectSnapshot("foreign byte order");
+        if (header.version != snapshotVersion) return rejectSnapshot("unsupported version");
+        if (length < sizeof(header) + (uint64_t)header.sectionCount * sizeof(SnapshotSectionEntry))
+            return rejectSnapshot("truncated directory");
+
+        unordered_map<uint32_t, pair<const char*, size_t>> found;
+        const char* entries = base + sizeof(header);
+        for (uint32_t i = 0; i < header.sectionCount; i++) {
+            SnapshotSectionEntry entry;
+            memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+            if (entry.offset % 8 != 0 || entry.offset > length || entry.size > length - entry.offset)
+                return rejectSnapshot("section out of bounds");
+            found[entry.tag] = {base + entry.offset, entry.size};
+        }
+
+        for (uint32_t tag = SECTION_STATION_OFFSETS; tag <= SECTION_LINE_SLOTS; tag++) {
+            if (!found.count(tag)) return rejectSnapshot("missing section");
+        }
+
+        auto ints = [&](uint32_t tag) { return reinterpret_cast<const int*>(found[tag].first); };
+        auto intCount = [&](uint32_t tag) { return found[tag].second / sizeof(int); };
+
+        size_t n = intCount(SECTION_ADJ_OFFSET) - 1;
+        size_t m = intCount(SECTION_EDGE_TO);
+        if (intCount(SECTION_ADJ_OFFSET) == 0 || intCount(SECTION_STATION_OFFSETS) != n + 1 ||
+            intCount(SECTION_EDGE_WEIGHT) != m || intCount(SECTION_EDGE_LINE) != m ||
+            (size_t)ints(SECTION_ADJ_OFFSET)[n] != m)
+            return rejectSnapshot("inconsistent section sizes");
+
+        if (!viewNames(found[SECTION_STATION_OFFSETS], found[SECTION_STATION_POOL], found[SECTION_STATION_SLOTS], stations) ||
+            !viewNames(found[SECTION_LINE_OFFSETS], found[SECTION_LINE_POOL], found[SECTION_LINE_SLOTS], lines))
+            return rejectSnapshot("bad string pool");
+
+        adjOffset.view(ints(SECTION_ADJ_OFFSET), n + 1);
+        edgeTo.view(ints(SECTION_EDGE_TO), m);
+        edgeWeight.view(ints(SECTION_EDGE_WEIGHT), m);
+        edgeLine.view(ints(SECTION_EDGE_LINE), m);
+
+        // The hierarchy is optional; without it buildIndexes() contracts the graph again
+        if (found.count(SECTION_CH_RANK) && found.count(SECTION_CH_OFFSET) && found.count(SECTION_CH_TO) &&
+            found.count(SECTION_CH_WEIGHT) && found.count(SECTION_CH_MIDDLE)) {
+            size_t upward = intCount(SECTION_CH_TO);
+            if (intCount(SECTION_CH_RANK) != n || intCount(SECTION_CH_OFFSET) != n + 1 ||
+                intCount(SECTION_CH_WEIGHT) != upward || intCount(SECTION_CH_MIDDLE) != upward ||
+                (size_t)ints(SECTION_CH_OFFSET)[n] != upward)
+                return rejectSnapshot("inconsistent hierarchy sections");
+
+            hierarchy.rank.view(ints(SECTION_CH_RANK), n);
+            hierarchy.offset.view(ints(SECTION_CH_OFFSET), n + 1);
+            hierarchy.to.view(ints(SECTION_CH_TO), upward);
+            hierarchy.weight.view(ints(SECTION_CH_WEIGHT), upward);
+            hierarchy.middle.view(ints(SECTION_CH_MIDDLE), upward);
+        }
+
+        if (found.count(SECTION_HUB_ORDER) && found.count(SECTION_HUB_OFFSET) && found.count(SECTION_HUB_INDEX) &&
+            found.count(SECTION_HUB_DIST) && found.count(SECTION_HUB_PARENT)) {
+            size_t entries = intCount(SECTION_HUB_INDEX);
+            if (intCount(SECTION_HUB_ORDER) != n || intCount(SECTION_HUB_OFFSET) != n + 1 ||
+                intCount(SECTION_HUB_DIST) != entries || intCount(SECTION_HUB_PARENT) != entries ||
+                (size_t)ints(SECTION_HUB_OFFSET)[n] != entries)
+                return rejectSnapshot("inconsistent hub label sections");
+
+            hubLabels.order.view(ints(SECTION_HUB_ORDER), n);
+            hubLabels.offset.view(ints(SECTION_HUB_OFFSET), n + 1);
+            hubLabels.hub.view(ints(SECTION_HUB_INDEX), entries);
+            hubLabels.dist.view(ints(SECTION_HUB_DIST), entries);
+            hubLabels.parent.view(ints(SECTION_HUB_PARENT), entries);
+        }
+
+        if (found.count(SECTION_ALT_LANDMARKS) && found.count(SECTION_ALT_DIST)) {
+            size_t k = intCount(SECTION_ALT_LANDMARKS);
+            if (k == 0 || intCount(SECTION_ALT_DIST) != n * k) return rejectSnapshot("inconsistent landmark sections");
+
+            landmarks.station.view(ints(SECTION_ALT_LANDMARKS), k);
+            landmarks.dist.view(ints(SECTION_ALT_DIST), n * k);
+        }
+
+        auto elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        cout << "Loaded snapshot " << filename << ": " << n << " stations, " << m
+             << " edges in " << elapsed << " us" << endl;
+
+        buildIndexes();
+        return true;
+    }
+
+    bool rejectSnapshot(const string& reason) {
+        cout << "Error loading snapshot: " << reason << endl;
+        snapshot.close();
+        return false;
+    }
+
+    bool viewNames(pair<const char*, size_t> offsets, pair<const char*, size_t> pool,
+                   pair<const char*, size_t> slots, NameTable& names) {
+        size_t count = offsets.second / sizeof(uint32_t);
+        size_t slotCount = slots.second / sizeof(int);
+        if (count == 0 || slotCount == 0 || (slotCount & (slotCount - 1)) != 0) return false;
+
+        const uint32_t* offset = reinterpret_cast<const uint32_t*>(offsets.first);
+        if (offset[0] != 0 || offset[count - 1] != pool.second) return false;
+
+        names.offset.view(offset, count);
+        names.pool.view(pool.first, pool.second);
+        names.slots.view(reinterpret_cast<const int*>(slots.first), slotCount);
+        return true;
+    }
+
+    // Cost models for search(). A policy names the nodes searched (stations or
+    // line states), seeds the source, orders labels through key(), decides when
+    // a label beats another through improves() and offers each neighbour of a
+    // settled node with its new label through relax(). The kernel is
+    // instantiated once per policy, so all of these inline into its loop.
+    //
+    // Labels are (cost, tag). Policies with 64-bit keys pack two words; those
+    // with levelKeys pack (changes, metres) as exchangeKey() does.
+    struct DistancePolicy {
+        typedef uint32_t Key;
+        static constexpr bool monotone = true;  // keys never drop below the last one popped
+        const MetroGraph& graph;
+
+        size_t size() const { return graph.stations.size(); }
+        int station(int u) const { return u; }
+        Key key(int, int cost, int) const { return cost; }
+        bool improves(int cost, int, const SearchLabels::Label& old) const { return cost < old.dist; }
+
+        template <typename Seed>
+        void seed(int sourceId, Seed&& seed) const { seed(sourceId, 0, -1); }
+
+        template <typename Offer>
+        void relax(int u, int cost, int, Offer&& offer) const {
+            for (int e = graph.adjOffset[u]; e < graph.adjOffset[u + 1]; e++) {
+                offer(graph.edgeTo[e], cost + graph.edgeWeight[e], -1);
+            }
+        }
+    };
+
+    // Distance ordered by cost + heuristic(station). An admissible heuristic
+    // need not be consistent, so keys can drop and only a binary heap will do.
+    // Labels still compare by distance alone.
+    template <typename Heuristic>
+    struct AStarPolicy : DistancePolicy {
+        static constexpr bool monotone = false;
+        const Heuristic& heuristic;
+
+        Key key(int u, int cost, int) const { return cost + heuristic(u); }
+    };
+
+    // Line states, seeded on every line at the source with no change made yet
+    struct StatePolicy {
+        const MetroGraph& graph;
+
+        size_t size() const { return graph.lineStates.line.size(); }
+        int station(int k) const { return graph.lineStates.station[k]; }
+        bool improves(int cost, int, const SearchLabels::Label& old) const { return cost < old.dist; }
+
+        template <typename Seed>
+        void seed(int sourceId, Seed&& seed) const {
+            for (int k = graph.lineStates.offset[sourceId]; k < graph.lineStates.offset[sourceId + 1]; k++) seed(k, 0, 0);
+        }
+
+        bool changesLine(int k, int e) const { return graph.edgeLine[e] != graph.lineStates.line[k]; }
+    };
+
+    // Fewest line changes, then fewest metres. Cost is metres, tag is changes.
+    struct ExchangePolicy : StatePolicy {
+        typedef uint64_t Key;
+        static constexpr bool monotone = true;
+        static constexpr bool levelKeys = true;  // key >> 32 rises by at most one per edge
+
+        Key key(int, int cost, int changes) const { return exchangeKey(changes, cost); }
+        bool improves(int cost, int changes, const SearchLabels::Label& old) const {
+            return exchangeKey(changes, cost) < exchangeKey(old.tag, old.dist);
+        }
+
+        template <typename Offer>
+        void relax(int k, int cost, int changes, Offer&& offer) const {
+            const LineStates& ls = graph.lineStates;
+            int u = ls.station[k];
+            for (int e = graph.adjOffset[u]; e < graph.adjOffset[u + 1]; e++) {
+                offer(ls.edgeState[e], cost + graph.edgeWeight[e], changes + changesLine(k, e));
+            }
+        }
+    };
+
+    // Fewest metres over the pieces of fewest-change line sequences (see
+    // lineGraphSearch()); the tag is the piece's level, i.e. changes so far
+    struct LineGraphPolicy : StatePolicy {
+        typedef uint32_t Key;
+        static constexpr bool monotone = true;
+        const vector<int>& fromSource;
+        const vector<int>& toDest;
+        int changes;
+
+        bool onSequence(int piece) const {
+            return fromSource[piece] != INT_MAX && toDest[piece] != INT_MAX && fromSource[piece] + toDest[piece] == changes;
+        }
+
+        Key key(int, int cost, int) const { return cost; }
+
+        template <typename Seed>
+        void seed(int sourceId, Seed&& seed) const {
+            StatePolicy::seed(sourceId, [&](int k, int cost, int level) {
+                if (onSequence(graph.lineGraph.statePiece[k])) seed(k, cost, level);
+            });
+        }
+
+        template <typename Offer>
+        void relax(int k, int cost, int level, Offer&& offer) const {
+            const LineStates& ls = graph.lineStates;
+            int u = ls.station[k];
+            for (int e = graph.adjOffset[u]; e < graph.adjOffset[u + 1]; e++) {
+                int target = ls.edgeState[e];
+                int piece = graph.lineGraph.statePiece[target];
+                if (changesLine(k, e) && (fromSource[piece] != level + 1 || !onSequence(piece))) continue;
+                offer(target, cost + graph.edgeWeight[e], fromSource[piece]);
+            }
+        }
+    };
+
+    // Travel time in seconds: running time at trainSpeedKmh, dwellSeconds at
+    // every stop reached and transferSeconds per line change. Tag is changes.
+    struct TimePolicy : StatePolicy {
+        typedef uint32_t Key;
+        static constexpr bool monotone = true;
+
+        Key key(int, int cost, int) const { return cost; }
+
+        template <typename Offer>
+        void relax(int k, int cost, int changes, Offer&& offer) const {
+            const LineStates& ls = graph.lineStates;
+            int u = ls.station[k];
+            for (int e = graph.adjOffset[u]; e < graph.adjOffset[u + 1]; e++) {
+                bool change = changesLine(k, e);
+                offer(ls.edgeState[e], cost + graph.travelSeconds(e, change), changes + change);
+            }
+        }
+    };
+
+    int travelSeconds(int e, bool change) const {
+        int seconds = (long long)edgeWeight[e] * 3600 / (trainSpeedKmh * metresPerKm) + dwellSeconds;
+        return seconds + (change ? transferSeconds : 0);
+    }
+
+    // Cheapest metres (or seconds, as in TimePolicy, when timed), then fewest
+    // line changes. Cost is the key's high word, so keys rise with cost and a
+    // budget can end the search. Tag is changes.
+    template <bool timed>
+    struct ReachPolicy : StatePolicy {
+        typedef uint64_t Key;
+        static constexpr bool monotone = true;
+        static constexpr bool levelKeys = false;
+
+        Key key(int, int cost, int changes) const { return (uint64_t)cost << 32 | (uint32_t)changes; }
+        bool improves(int cost, int changes, const SearchLabels::Label& old) const {
+            return key(0, cost, changes) < key(0, old.dist, old.tag);
+        }
+
+        template <typename Offer>
+        void relax(int k, int cost, int changes, Offer&& offer) const {
+            const LineStates& ls = graph.lineStates;
+            int u = ls.station[k];
+            for (int e = graph.adjOffset[u]; e < graph.adjOffset[u + 1]; e++) {
+                bool change = changesLine(k, e);
+                int step = timed ? graph.travelSeconds(e, change) : graph.edgeWeight[e];
+                offer(ls.edgeState[e], cost + step, changes + change);
+            }
+        }
+    };
+
+    // Generalised cost in metres: distance plus exchangePenaltyMetres per line
+    // change, trading a change against that much extra riding. Tag is changes.
+    struct GeneralisedCostPolicy : StatePolicy {
+        typedef uint32_t Key;
+        static constexpr bool monotone = true;
+
+        Key key(int, int cost, int) const { return cost; }
+
+        template <typename Offer>
+        void relax(int k, int cost, int changes, Offer&& offer) const {
+            const LineStates& ls = graph.lineStates;
+            int u = ls.station[k];
+            for (int e = graph.adjOffset[u]; e < graph.adjOffset[u + 1]; e++) {
+                bool change = changesLine(k, e);
+                offer(ls.edgeState[e], cost + graph.edgeWeight[e] + (change ? exchangePenaltyMetres : 0), changes + change);
+            }
+        }
+    };
+
+    // The one Dijkstra loop. Labels go to labels; settled counts the nodes
+    // settled, and visit(u) is called on each. Stops once a node of station
+    // destId is settled and returns it; destId = -1 settles everything
+    // reachable and returns -1. The search also stops at the first label
+    // costing more than maxCost, which is only meaningful for policies whose
+    // keys rise with cost.
+    template <typename Policy, typename Queue, typename Visit>
+    int search(const Policy& policy, int sourceId, int destId, int maxCost, SearchLabels& labels, Queue& pq,
+               int& settled, Visit&& visit) {
+        labels.reset(policy.size());
+        pq.clear();
+        policy.seed(sourceId, [&](int u, int cost, int tag) {
+            labels.set(u, cost, -1, tag);
+            pq.push(policy.key(u, cost, tag), u);
+        });
+        settled = 0;
+
+        while (!pq.empty()) {
+            auto [key, u] = pq.pop();
+            if (key != policy.key(u, labels[u].dist, labels[u].tag)) continue;
+            if (labels[u].dist > maxCost) break;
+            settled++;
+            visit(u);
+            if (policy.station(u) == destId) return u;
+
+            policy.relax(u, labels[u].dist, labels[u].tag, [&](int v, int cost, int tag) {
+                if (!labels.reached(v) || policy.improves(cost, tag, labels[v])) {
+                    labels.set(v, cost, u, tag);
+                    pq.push(policy.key(v, cost, tag), v);
+                }
+            });
+        }
+
+        return -1;
+    }
+
+    // Picks the queue for the policy: level buckets for exchange keys, a radix
+    // heap for other monotone keys, else a binary heap
+    template <typename Policy, typename Visit>
+    int search(const Policy& policy, int sourceId, int destId, int maxCost, SearchLabels& labels, int& settled,
+               Visit&& visit) {
+        SearchWorkspace& ws = SearchWorkspace::local();
+        if constexpr (is_same_v<typename Policy::Key, uint64_t>) {
+            if (Policy::levelKeys && useLevelBuckets)
+                return search(policy, sourceId, destId, maxCost, labels, ws.levels, settled, visit);
+            if (useRadixHeap) return search(policy, sourceId, destId, maxCost, labels, ws.exchangeRadix, settled, visit);
+            return search(policy, sourceId, destId, maxCost, labels, ws.exchangeHeap, settled, visit);
+        } else {
+            if (Policy::monotone && useRadixHeap)
+                return search(policy, sourceId, destId, maxCost, labels, ws.radix, settled, visit);
+            return search(policy, sourceId, destId, maxCost, labels, ws.heap[0], settled, visit);
+        }
+    }
+
+    template <typename Policy>
+    int search(const Policy& policy, int sourceId, int destId, SearchLabels& labels, int& settled) {
+        return search(policy, sourceId, destId, infDistance, labels, settled, [](int) {});
+    }
+
+    // Dijkstra from sourceId over the station graph into labels. Stops once
+    // destId is settled; destId = -1 settles every reachable station.
+    // Returns the number of stations settled.
+    int dijkstraSearch(int sourceId, int destId, SearchLabels& labels) {
+        int settled;
+        search(DistancePolicy{*this}, sourceId, destId, labels, settled);
+        return settled;
+    }
+
+    // Plain Dijkstra between two stations. Returns metres (infDistance when
+    // unreachable) and fills route with station IDs from source to destination.
+    int shortestPathDijkstra(int sourceId, int destId, vector<int>& route, int& settled) {
+        SearchLabels& labels = SearchWorkspace::local().labels[0];
+        settled = dijkstraSearch(sourceId, destId, labels);
+
+        route.clear();
+        if (!labels.reached(destId)) return infDistance;
+
+        for (int at = destId; at != -1; at = labels[at].parent) {
+            route.push_back(at);
+        }
+        reverse(route.begin(), route.end());
+        return labels[destId].dist;
+    }
+
+    int shortestPathTree(const SourceTree& tree, int destId, vector<int>& route) {
+        route.clear();
+        if (tree.dist[destId] == infDistance) return infDistance;
+
+        for (int at = destId; at != -1; at = tree.parent[at]) {
+            route.push_back(at);
+        }
+        reverse(route.begin(), route.end());
+        return tree.dist[destId];
+    }
+
+    // Settles every station reachable from sourceId
+    shared_ptr<const SourceTree> buildSourceTree(int sourceId, int& settled) {
+        SearchLabels& labels = SearchWorkspace::local().labels[0];
+        settled = dijkstraSearch(sourceId, -1, labels);
+
+        int n = stations.size();
+        auto tree = make_shared<SourceTree>();
+        tree->source = sourceId;
+        tree->dist.resize(n);
+        tree->parent.resize(n);
+        for (int u = 0; u < n; u++) {
+            tree->dist[u] = labels.dist(u);
+            tree->parent[u] = labels.reached(u) ? labels[u].parent : -1;
+        }
+        return tree;
+    }
+
+    // Counts a lookup for sourceId. Returns its cached tree, or null with admit
+    // set when a tree built for sourceId would be kept.
+    shared_ptr<const SourceTree> findSourceTree(int sourceId, bool& admit) {
+        lock_guard<mutex> lock(sourceTreeMutex);
+        SourceTreeCache& cache = sourceTrees;
+
+        if (++cache.lookups == SourceTreeCache::agingPeriod) {
+            cache.lookups = 0;
+            for (auto it = cache.frequency.begin(); it != cache.frequency.end();) {
+                it->second /= 2;
+                it = it->second == 0 ? cache.frequency.erase(it) : next(it);
+            }
+        }
+        uint32_t count = ++cache.frequency[sourceId];
+
+        for (const auto& tree : cache.trees) {
+            if (tree->source == sourceId) {
+                cache.hits++;
+                return tree;
+            }
+        }
+        admit = sourceTreeCapacity > 0 && count >= 2 &&
+                (cache.trees.size() < sourceTreeCapacity || count > cache.count(cache.trees[cache.victim()]->source));
+        return nullptr;
+    }
+
+    void storeSourceTree(shared_ptr<const SourceTree> tree) {
+        lock_guard<mutex> lock(sourceTreeMutex);
+        SourceTreeCache& cache = sourceTrees;
+
+        // Another thread may have built the same tree meanwhile
+        for (const auto& cached : cache.trees) {
+            if (cached->source == tree->source) return;
+        }
+        if (cache.trees.size() < sourceTreeCapacity) {
+            cache.trees.push_back(move(tree));
+        } else {
+            size_t worst = cache.victim();
+            if (cache.count(tree->source) <= cache.count(cache.trees[worst]->source)) return;
+            cache.trees[worst] = move(tree);
+        }
+        cache.builds++;
+    }
 
-struct Connection {
-    string station;
-    double distance;
-    string lineColor;
-};
+    // Dijkstra from both ends at once, always advancing the side with the smaller
+    // queue head. best is the shortest source-destination path seen through an
+    // edge joining the two searches; once the two heads sum to at least best, no
+    // unsettled node can be on a shorter path. The graph is undirected, so the
+    // backward search walks the same adjacency.
+    int shortestPathBidirectional(int sourceId, int destId, vector<int>& route, int& settled) {
+        SearchWorkspace& ws = SearchWorkspace::local();
+        SearchLabels* labels = ws.labels;
+        BinaryHeap<uint32_t>* pq = ws.heap;
+
+        for (int side = 0; side < 2; side++) {
+            labels[side].reset(stations.size());
+            pq[side].clear();
+        }
+        labels[0].set(sourceId, 0, -1);
+        labels[1].set(destId, 0, -1);
+        pq[0].push(0, sourceId);
+        pq[1].push(0, destId);
 
-struct Edge {
-    int to;
-    double weight;
-    int lineId;
-};
+        int best = sourceId == destId ? 0 : infDistance;
+        int meet = sourceId;
+        settled = 0;
 
+        while (!pq[0].empty() && !pq[1].empty()) {
+            // Heads are compared in 64 bits: best may still be infDistance
+            if ((long long)pq[0].top().first + pq[1].top().first >= best) break;
 
-class MetroGraph {
-public:
-    unordered_map<string, vector<Connection>> adjList;
-    unordered_map<string, int> stationToId;
-    vector<string> idToStation;
-    vector<vector<Edge>> adjInt;
-    unordered_map<string, int> lineToId;
-    vector<string> idToLine;
-    list<string> lruList;  // Most recent at front
-    unordered_map<string, pair<json, list<string>::iterator>> routeCache;
+            int side = pq[0].top().first <= pq[1].top().first ? 0 : 1;
+            auto [key, u] = pq[side].pop();
+            int currDist = key;
 
-    void trim(string &s) {
-        s.erase(s.begin(), find_if(s.begin(), s.end(), [](unsigned char ch) { return !isspace(ch); }));
-        s.erase(find_if(s.rbegin(), s.rend(), [](unsigned char ch) { return !isspace(ch); }).base(), s.end());
-    }
+            if (currDist > labels[side][u].dist) continue;
+            settled++;
+
+            for (int e = adjOffset[u]; e < adjOffset[u + 1]; e++) {
+                int v = edgeTo[e];
+                int newDist = currDist + edgeWeight[e];
+
+                if (newDist < labels[side].dist(v)) {
+                    labels[side].set(v, newDist, u);
+                    pq[side].push(newDist, v);
+                }
+
+                // Join through v's own labels, which are never worse than the path via u
+                int other = labels[1 - side].dist(v);
+                if (other != infDistance && labels[side][v].dist + other < best) {
+                    best = labels[side][v].dist + other;
+                    meet = v;
+                }
+            }
+        }
 
-    void addEdge(string station1, string station2, double distance, string lineColor) {
-        trim(station1);
-        trim(station2);
-        trim(lineColor);
+        route.clear();
+        if (best == infDistance) return infDistance;
 
-        if (!station1.empty() && !station2.empty() && station1 != station2) {
-            adjList[station1].push_back({station2, distance, lineColor});
-            adjList[station2].push_back({station1, distance, lineColor});
+        for (int at = meet; at != -1; at = labels[0][at].parent) {
+            route.push_back(at);
+        }
+        reverse(route.begin(), route.end());
+        for (int at = labels[1][meet].parent; at != -1; at = labels[1][at].parent) {
+            route.push_back(at);
         }
+        return best;
     }
 
-    void loadFromFile(string filename) {
-        ifstream file(filename);
-        string line, station1, station2, lineColor;
-        double distance;
+    // Lower bound on the remaining metres to one destination: straight-line
+    // distance scaled by geoScale, rounded down. 0 for a station without a position.
+    struct GeoHeuristic {
+        const vector<GeoPoint>& point;
+        const vector<char>& known;
+        int target;
+        double scale;
+
+        int operator()(int station) const {
+            if (!known[station] || !known[target]) return 0;
+            return (int)(scale * chordMetres(point[station], point[target]));
+        }
+    };
+
+    // Triangle inequality over the landmarks: |d(L, t) - d(L, u)| <= d(u, t).
+    // Consistent, so A* never reopens a station with it.
+    struct LandmarkHeuristic {
+        const int* table;
+        int k;
+        int target;
+
+        int operator()(int station) const {
+            const int* row = table + (size_t)station * k;
+            const int* targetRow = table + (size_t)target * k;
+            int best = 0;
+            for (int i = 0; i < k; i++) {
+                if (row[i] == infDistance || targetRow[i] == infDistance) continue;
+                best = max(best, abs(targetRow[i] - row[i]));
+            }
+            return best;
+        }
+    };
+
+    // A* from sourceId: Dijkstra ordered by dist + heuristic(station). The
+    // heuristic only has to be admissible: a station whose distance improves
+    // after it was popped is queued again, and the destination's distance is
+    // final when it is popped.
+    template <typename Heuristic>
+    int shortestPathAStar(int sourceId, int destId, vector<int>& route, int& settled, const Heuristic& heuristic) {
+        SearchLabels& labels = SearchWorkspace::local().labels[0];
+        search(AStarPolicy<Heuristic>{{*this}, heuristic}, sourceId, destId, labels, settled);
+
+        route.clear();
+        if (!labels.reached(destId)) return infDistance;
+
+        for (int at = destId; at != -1; at = labels[at].parent) {
+            route.push_back(at);
+        }
+        reverse(route.begin(), route.end());
+        return labels[destId].dist;
+    }
 
-        if (!file.is_open()) {
-            cout << "Error opening file!" << endl;
-            return;
+    // Bidirectional Dijkstra over upward edges only: both searches climb the
+    // hierarchy and meet at the highest station of the shortest path. A side
+    // stops once its queue head reaches the best meeting distance. A station is
+    // stalled, not expanded, when a higher neighbour already reaches it more
+    // cheaply, since its label then cannot lie on a shortest path.
+    int shortestPathHierarchy(int sourceId, int destId, vector<int>& route, int& settled) {
+        const ContractionHierarchy& ch = hierarchy;
+        SearchWorkspace& ws = SearchWorkspace::local();
+        SearchLabels* labels = ws.labels;
+        BinaryHeap<uint32_t>* pq = ws.heap;
+
+        for (int side = 0; side < 2; side++) {
+            labels[side].reset(stations.size());
+            pq[side].clear();
         }
+        labels[0].set(sourceId, 0, -1);
+        labels[1].set(destId, 0, -1);
+        pq[0].push(0, sourceId);
+        pq[1].push(0, destId);
+
+        int best = infDistance, meet = -1;
+        settled = 0;
+
+        while (true) {
+            bool open0 = !pq[0].empty() && (int)pq[0].top().first < best;
+            bool open1 = !pq[1].empty() && (int)pq[1].top().first < best;
+            if (!open0 && !open1) break;
+
+            int side = open0 && (!open1 || pq[0].top().first <= pq[1].top().first) ? 0 : 1;
+            auto [key, u] = pq[side].pop();
+            int currDist = key;
+
+            if (currDist > labels[side][u].dist) continue;
+
+            int first = ch.offset[ch.rank[u]], last = ch.offset[ch.rank[u] + 1];
+            bool stalled = false;
+            for (int e = first; e < last && !stalled; e++) {
+                int v = ch.to[e];
+                stalled = labels[side].reached(v) && labels[side][v].dist + ch.weight[e] < currDist;
+            }
+            if (stalled) continue;
+            settled++;
+
+            int other = labels[1 - side].dist(u);
+            if (other != infDistance && currDist + other < best) {
+                best = currDist + other;
+                meet = u;
+            }
 
-        getline(file, line); // Skip header
+            for (int e = first; e < last; e++) {
+                int v = ch.to[e];
+                int newDist = currDist + ch.weight[e];
 
-        while (getline(file, line)) {
-            stringstream ss(line);
-            getline(ss, station1, ',');
-            getline(ss, station2, ',');
-            getline(ss, lineColor, ',');
-            ss >> distance;
+                if (newDist < labels[side].dist(v)) {
+                    labels[side].set(v, newDist, u, e);
+                    pq[side].push(newDist, v);
+                }
+            }
+        }
 
-            addEdge(station1, station2, distance, lineColor);
+        route.clear();
+        if (meet != -1) {
+            // Upward edges from the source to the meeting station, then back down to the destination
+            vector<int>& climb = ws.walk;
+            climb.clear();
+            for (int at = meet; at != sourceId; at = labels[0][at].parent) climb.push_back(at);
+            route.push_back(sourceId);
+            for (int i = climb.size() - 1; i >= 0; i--) {
+                unpackHierarchyEdge(labels[0][climb[i]].parent, labels[0][climb[i]].tag, true, route);
+            }
+            for (int at = meet; at != destId; at = labels[1][at].parent) {
+                unpackHierarchyEdge(labels[1][at].parent, labels[1][at].tag, false, route);
+            }
         }
 
-        file.close();
+        return best;
     }
 
-    void buildIntegerGraph() {
-        stationToId.clear();
-        idToStation.clear();
-        adjInt.clear();
-        lineToId.clear();
-        idToLine.clear();
-
+    // Calls visit(point, metres) for every point where u can meet another station
+    // on a shortest path: the hubs of u's label, or else the stations of u's
+    // upward search in the contraction hierarchy, less those stalled from above.
+    // A hub is given as its index, which like a station is below stations.size().
+    template <typename Visit>
+    void forEachMeetingPoint(int u, SearchLabels& labels, BinaryHeap<uint32_t>& pq, Visit&& visit) {
+        if (!hubLabels.empty()) {
+            for (int i = hubLabels.offset[u]; i < hubLabels.offset[u + 1]; i++) visit(hubLabels.hub[i], hubLabels.dist[i]);
+            return;
+        }
 
-        int stationId = 0;
-        int lineIdCounter = 0;
+        const ContractionHierarchy& ch = hierarchy;
+        labels.reset(stations.size());
+        pq.clear();
+        labels.set(u, 0, -1);
+        pq.push(0, u);
 
-        for (auto& station : adjList) {
-            stationToId[station.first] = stationId++;
-            idToStation.push_back(station.first);
+        while (!pq.empty()) {
+            auto [key, v] = pq.pop();
+            int currDist = key;
+            if (currDist > labels[v].dist) continue;
+
+            int first = ch.offset[ch.rank[v]], last = ch.offset[ch.rank[v] + 1];
+            bool stalled = false;
+            for (int e = first; e < last && !stalled; e++) {
+                int w = ch.to[e];
+                stalled = labels.reached(w) && labels[w].dist + ch.weight[e] < currDist;
+            }
+            if (stalled) continue;
+            visit(v, currDist);
+
+            for (int e = first; e < last; e++) {
+                int w = ch.to[e];
+                int newDist = currDist + ch.weight[e];
+                if (newDist < labels.dist(w)) {
+                    labels.set(w, newDist, v);
+                    pq.push(newDist, w);
+                }
+            }
         }
+    }
 
-        adjInt.resize(stationId);
+    // Appends the stations of upward edge e of lower, excluding the one the walk
+    // starts from: lower -> to[e] when upward, to[e] -> lower otherwise.
+    void unpackHierarchyEdge(int lower, int e, bool upward, vector<int>& route) {
+        const ContractionHierarchy& ch = hierarchy;
 
-        for (auto& station : adjList) {
-            int fromId = stationToId[station.first];
+        auto upwardEdge = [&](int from, int target) {
+            for (int i = ch.offset[ch.rank[from]]; i < ch.offset[ch.rank[from] + 1]; i++) {
+                if (ch.to[i] == target) return i;
+            }
+            return -1;
+        };
 
-            for (auto& neighbor : station.second) {
-                if (!lineToId.count(neighbor.lineColor)) {
-                    lineToId[neighbor.lineColor] = lineIdCounter++;
-                    idToLine.push_back(neighbor.lineColor);
-                }
-                int toId = stationToId[neighbor.station];
-                int lineId = lineToId[neighbor.lineColor];
+        // Pending pieces, last one next: (lower station, edge, upward)
+        thread_local vector<tuple<int,int,bool>> stack;
+        stack.assign(1, {lower, e, upward});
+        while (!stack.empty()) {
+            auto [low, edge, up] = stack.back();
+            stack.pop_back();
+
+            int m = ch.middle[edge];
+            if (m == -1) {
+                route.push_back(up ? ch.to[edge] : low);
+                continue;
+            }
 
-                adjInt[fromId].push_back({toId, neighbor.distance, lineId});
+            // low -> high is low -> m (m's edge to low, walked down) then m -> high
+            int toLow = upwardEdge(m, low), toHigh = upwardEdge(m, ch.to[edge]);
+            if (up) {
+                stack.push_back({m, toHigh, true});
+                stack.push_back({m, toLow, false});
+            } else {
+                stack.push_back({m, toLow, true});
+                stack.push_back({m, toHigh, false});
             }
         }
-        adjList.clear();
-        adjList.rehash(0);
+    }
 
+    // Merge-join of two labels. Returns metres, or infDistance when they share no
+    // hub, and the hub index the best route passes through in bestHub.
+    int hubDistance(int sourceId, int destId, int& bestHub) {
+        const HubLabels& hl = hubLabels;
+        int i = hl.offset[sourceId], iEnd = hl.offset[sourceId + 1];
+        int j = hl.offset[destId], jEnd = hl.offset[destId + 1];
+        int best = infDistance;
+        bestHub = -1;
+
+        while (i < iEnd && j < jEnd) {
+            if (hl.hub[i] < hl.hub[j]) {
+                i++;
+            } else if (hl.hub[i] > hl.hub[j]) {
+                j++;
+            } else {
+                if (hl.dist[i] + hl.dist[j] < best) {
+                    best = hl.dist[i] + hl.dist[j];
+                    bestHub = hl.hub[i];
+                }
+                i++;
+                j++;
+            }
+        }
+        return best;
     }
 
-    json findShortestPathOptimized(const string& source, const string& destination) {
-        string cacheKey = "shortest|" + source + "|" + destination;
+    // Distance from the labels, then the route walked from both ends toward the
+    // common hub through the stored parents
+    int shortestPathHubLabels(int sourceId, int destId, vector<int>& route) {
+        const HubLabels& hl = hubLabels;
+        int bestHub;
+        int distance = hubDistance(sourceId, destId, bestHub);
 
-        {
-            lock_guard<mutex> lock(cacheMutex);
+        route.clear();
+        if (distance == infDistance) return infDistance;
+
+        auto parentToward = [&](int station) {
+            const int* first = hl.hub.begin() + hl.offset[station];
+            const int* last = hl.hub.begin() + hl.offset[station + 1];
+            return hl.parent[lower_bound(first, last, bestHub) - hl.hub.begin()];
+        };
+
+        for (int at = sourceId; at != -1; at = parentToward(at)) {
+            route.push_back(at);
+        }
+        vector<int>& fromDest = SearchWorkspace::local().walk;
+        fromDest.clear();
+        for (int at = destId; at != -1; at = parentToward(at)) {
+            fromDest.push_back(at);
+        }
+        // Both walks end at the hub; keep it once
+        route.insert(route.end(), fromDest.rbegin() + 1, fromDest.rend());
+        return distance;
+    }
+
+    // Answer from the routing table by following next hops toward destId
+    int shortestPathTable(int sourceId, int destId, vector<int>& route) {
+        size_t row = (size_t)destId * stations.size();
+
+        route.clear();
+        if (routingTable.dist[row + sourceId] == infDistance) return infDistance;
+
+        for (int at = sourceId; at != -1; at = routingTable.next[row + at]) {
+            route.push_back(at);
+        }
+        return routingTable.dist[row + sourceId];
+    }
+
+    // Same contract as shortestPathDijkstra(), searching only the chain overlay.
+    // A station inside a chain enters or leaves the overlay through either chain end.
+    int shortestPathOverlay(int sourceId, int destId, vector<int>& route, int& settled) {
+        const ChainOverlay& ov = overlay;
+
+        struct ChainEnd {
+            int node;       // overlay index of the chain end
+            int cost;       // metres between the station and that end
+            bool viaFirst;  // end is the first station of the chain
+        };
+
+        auto endsOf = [&](int station, ChainEnd out[2]) {
+            if (ov.nodeOf[station] != -1) {
+                out[0] = {ov.nodeOf[station], 0, true};
+                return 1;
+            }
+            int c = ov.chainOf[station];
+            int first = ov.chainOffset[c], last = ov.chainOffset[c + 1] - 1;
+            int d = ov.chainDist[first + ov.chainPos[station]];
+            out[0] = {ov.nodeOf[ov.chainStations[first]], d, true};
+            out[1] = {ov.nodeOf[ov.chainStations[last]], ov.chainDist[last] - d, false};
+            return 2;
+        };
 
-            auto it = routeCache.find(cacheKey);
-            if (it != routeCache.end()) {
-                // Move key to front (most recently used)
-                lruList.erase(it->second.second);
-                lruList.push_front(cacheKey);
-                it->second.second = lruList.begin();
+        ChainEnd seeds[2], exits[2];
+        int seedCount = endsOf(sourceId, seeds);
+        int exitCount = endsOf(destId, exits);
 
-                return it->second.first;
+        SearchWorkspace& ws = SearchWorkspace::local();
+        SearchLabels& labels = ws.labels[0];
+        BinaryHeap<uint32_t>& pq = ws.heap[0];
+        labels.reset(ov.node.size());
+        pq.clear();
+
+        for (int i = 0; i < seedCount; i++) {
+            if (seeds[i].cost < labels.dist(seeds[i].node)) {
+                labels.set(seeds[i].node, seeds[i].cost, -1);
+                pq.push(seeds[i].cost, seeds[i].node);
             }
         }
 
+        // Both stations inside the same chain: riding straight along it is a candidate
+        int best = infDistance, bestExit = -1;
+        int sameChain = ov.chainOf[sourceId];
+        if (sameChain != -1 && sameChain == ov.chainOf[destId]) {
+            int first = ov.chainOffset[sameChain];
+            best = abs(ov.chainDist[first + ov.chainPos[sourceId]] - ov.chainDist[first + ov.chainPos[destId]]);
+        }
 
+        settled = 0;
+        while (!pq.empty()) {
+            auto [key, u] = pq.pop();
+            int currDist = key;
 
-        json result;
+            if (currDist > labels[u].dist) continue;
+            if (currDist >= best) break;
+            settled++;
 
-        if (!stationToId.count(source) || !stationToId.count(destination)) {
-            result["error"] = "Error: One or both stations not found!";
-            return result;
+            for (int i = 0; i < exitCount; i++) {
+                if (exits[i].node == u && currDist + exits[i].cost < best) {
+                    best = currDist + exits[i].cost;
+                    bestExit = i;
+                }
+            }
+
+            for (int e = ov.offset[u]; e < ov.offset[u + 1]; e++) {
+                int v = ov.to[e];
+                int newDist = currDist + ov.weight[e];
+
+                if (newDist < labels.dist(v)) {
+                    labels.set(v, newDist, u, e);
+                    pq.push(newDist, v);
+                }
+            }
         }
 
-        int sourceId = stationToId[source];
-        int destId = stationToId[destination];
+        route.clear();
+        if (best == infDistance) return infDistance;
 
-        int n = adjInt.size();
-        thread_local vector<double> dist;
-        thread_local vector<int> parent;
+        auto append = [&](int station) {
+            if (route.empty() || route.back() != station) route.push_back(station);
+        };
+
+        // Stations of chain c from position `from` to position `to`, either direction
+        auto walkChain = [&](int c, int from, int to) {
+            int first = ov.chainOffset[c];
+            int step = from <= to ? 1 : -1;
+            for (int i = from; i != to + step; i += step) append(ov.chainStations[first + i]);
+        };
+
+        auto chainLength = [&](int c) { return ov.chainOffset[c + 1] - ov.chainOffset[c] - 1; };
+
+        if (bestExit == -1) {
+            walkChain(sameChain, ov.chainPos[sourceId], ov.chainPos[destId]);
+            return best;
+        }
+
+        // Overlay edges from the seed node to the exit node, in travel order
+        vector<int>& overlayEdges = ws.walk;
+        overlayEdges.clear();
+        int at = exits[bestExit].node;
+        while (labels[at].tag != -1) {
+            overlayEdges.push_back(labels[at].tag);
+            at = labels[at].parent;
+        }
+        reverse(overlayEdges.begin(), overlayEdges.end());
 
-        if (dist.size() != n) {
-            dist.resize(n);
-            parent.resize(n);
+        if (seedCount == 1) {
+            append(sourceId);
+        } else {
+            // The root was seeded by the cheaper chain end that maps to it
+            int k = (seeds[0].node == at && (seeds[1].node != at || seeds[0].cost <= seeds[1].cost)) ? 0 : 1;
+            int c = ov.chainOf[sourceId];
+            walkChain(c, ov.chainPos[sourceId], seeds[k].viaFirst ? 0 : chainLength(c));
         }
 
-        fill(dist.begin(), dist.end(), numeric_limits<double>::infinity());
-        fill(parent.begin(), parent.end(), -1);
+        for (int e : overlayEdges) {
+            int c = ov.chain[e];
+            if (c >= 0) walkChain(c, 0, chainLength(c));
+            else walkChain(~c, chainLength(~c), 0);
+        }
 
+        if (exitCount == 1) {
+            append(destId);
+        } else {
+            int c = ov.chainOf[destId];
+            walkChain(c, exits[bestExit].viaFirst ? 0 : chainLength(c), ov.chainPos[destId]);
+        }
+        return best;
+    }
 
-        priority_queue<pair<double,int>, vector<pair<double,int>>, greater<>> pq;
+    json findShortestPathOptimized(string_view source, string_view destination, ShortestPathEngine engine = EngineAuto) {
+        json result;
 
-        dist[sourceId] = 0;
-        pq.push({0, sourceId});
+        int sourceId = stations.find(source);
+        int destId = stations.find(destination);
 
-        while (!pq.empty()) {
-            auto [currDist, u] = pq.top();
-            pq.pop();
+        if (sourceId == -1 || destId == -1) {
+            result["error"] = "Error: One or both stations not found!";
+            return result;
+        }
 
-            if (currDist > dist[u]) continue;
-            if (u == destId) break;
+        if (!connected(sourceId, destId)) {
+            result["error"] = "Error: No path found!";
+            return result;
+        }
 
-            for (auto& edge : adjInt[u]) {
-                int v = edge.to;
-                double newDist = currDist + edge.weight;
+        // Engines agree on distance but may break ties between equal routes differently
+        if (engine == EngineTable && routingTable.empty()) engine = EngineAuto;
+        if (engine == EngineAStar && geoScale == 0) engine = EngineDijkstra;
+        if (engine == EngineHierarchy && hierarchy.empty()) engine = EngineAuto;
+        if (engine == EngineHubLabels && hubLabels.empty()) engine = EngineAuto;
+        if (engine == EngineLandmarks && landmarks.empty()) engine = EngineDijkstra;
+
+        // Auto answers are cached under "auto" whichever engine serves them, so
+        // the response cache sits in front of the tree cache
+        string cacheKey = "shortest|" + string(engineNames[engine]) + "|" + to_string(sourceId) + "|" + to_string(destId);
+        if (cacheLookup(cacheKey, result)) return result;
+
+        // A busy source's tree answers every destination with a walk up parents
+        shared_ptr<const SourceTree> tree;
+        bool admit = false;
+        if (engine == EngineTree || (engine == EngineAuto && routingTable.empty() && hubLabels.empty() &&
+                                     sourceTreeCapacity > 0)) {
+            tree = findSourceTree(sourceId, admit);
+            if (tree || admit) engine = EngineTree;
+        }
+        if (engine == EngineAuto) {
+            engine = !routingTable.empty() ? EngineTable
+                   : !hubLabels.empty() ? EngineHubLabels
+                   : !hierarchy.empty() ? EngineHierarchy
+                   : useChainOverlay ? EngineOverlay : EngineDijkstra;
+        }
 
-                if (newDist < dist[v]) {
-                    dist[v] = newDist;
-                    parent[v] = u;
-                    pq.push({newDist, v});
+        vector<int>& route = SearchWorkspace::local().route;
+        int distance, settled = 0;
+        switch (engine) {
+            case EngineTable: distance = shortestPathTable(sourceId, destId, route); break;
+            case EngineOverlay: distance = shortestPathOverlay(sourceId, destId, route, settled); break;
+            case EngineBidirectional: distance = shortestPathBidirectional(sourceId, destId, route, settled); break;
+            case EngineHierarchy: distance = shortestPathHierarchy(sourceId, destId, route, settled); break;
+            case EngineHubLabels: distance = shortestPathHubLabels(sourceId, destId, route); break;
+            case EngineTree:
+                // Requested explicitly, a source that is not admitted still gets a tree, used once
+                if (!tree) {
+                    tree = buildSourceTree(sourceId, settled);
+                    if (admit) storeSourceTree(tree);
                 }
-            }
+                distance = shortestPathTree(*tree, destId, route);
+                break;
+            case EngineAStar:
+                distance = shortestPathAStar(sourceId, destId, route, settled,
+                                             GeoHeuristic{stationPoint, hasPoint, destId, geoScale});
+                break;
+            case EngineLandmarks:
+                distance = shortestPathAStar(sourceId, destId, route, settled,
+                                             LandmarkHeuristic{landmarks.dist.data(), landmarks.count(), destId});
+                break;
+            default: distance = shortestPathDijkstra(sourceId, destId, route, settled); break;
         }
+        engineStats[engine].queries++;
+        engineStats[engine].settled += settled;
+        engineStats[engine].reachable += componentSize[componentOf[sourceId]];
 
-        if (dist[destId] == numeric_limits<double>::infinity()) {
+        if (distance == infDistance) {
             result["error"] = "Error: No path found!";
             return result;
         }
 
-        vector<string> path;
-        for (int at = destId; at != -1; at = parent[at]) {
-            path.push_back(idToStation[at]);
+        vector<string_view> path;
+        for (int station : route) {
+            path.push_back(stations.name(station));
         }
-        reverse(path.begin(), path.end());
 
         result["path"] = path;
-        result["total_distance"] = dist[destId];
+        result["total_distance"] = toKm(distance);
 
-        {
-            lock_guard<mutex> lock(cacheMutex);
+        cacheInsert(cacheKey, result);
+        return result;
+    }
+
+    // Cached response for key, which becomes the most recently used
+    bool cacheLookup(const string& key, json& response) {
+        lock_guard<mutex> lock(cacheMutex);
+
+        auto it = routeCache.find(key);
+        if (it == routeCache.end()) return false;
+
+        lruList.splice(lruList.begin(), lruList, it->second.second);
+        response = it->second.first;
+        return true;
+    }
+
+    void cacheInsert(const string& key, const json& response) {
+        lock_guard<mutex> lock(cacheMutex);
+
+        // If already exists (rare but safe)
+        if (routeCache.count(key)) {
+            lruList.erase(routeCache[key].second);
+        }
+        else if (routeCache.size() >= cacheCapacity) {
+            // Remove least recently used
+            string lruKey = lruList.back();
+            lruList.pop_back();
+            routeCache.erase(lruKey);
+        }
+
+        lruList.push_front(key);
+        routeCache[key] = {response, lruList.begin()};
+    }
+
+
+    // Lexicographic (line changes, metres) search over (station, line) states.
+    // Riding on costs no change; switching line costs one. Labels are ordered by
+    // changes first and metres second, both packed into the queue key, and never
+    // decrease as they are popped: with LevelBucketQueue, each change level is
+    // finished before the next. Labels go to labels per state, with the change
+    // count as the tag. Returns the first state of destId settled, or -1;
+    // destId = -1 settles every reachable state.
+    int exchangeSearch(int sourceId, int destId, SearchLabels& labels) {
+        int settled;
+        return search(ExchangePolicy{{*this}}, sourceId, destId, labels, settled);
+    }
 
-            // If already exists (rare but safe)
-            if (routeCache.count(cacheKey)) {
-                lruList.erase(routeCache[cacheKey].second);
+    // The (changes, metres) label packed into one key, changes in the high word,
+    // so that integer order is the lexicographic order of the labels
+    static uint64_t exchangeKey(int changes, int dist) {
+        return (uint64_t)changes << 32 | (uint32_t)dist;
+    }
+
+    // Minimum-exchange search in two steps. The change count comes from two BFS
+    // runs over the line graph, from the pieces serving sourceId and from those
+    // serving destId. A piece is on some fewest-change line sequence exactly when
+    // its two depths add up to that count. Metres are then minimised by a search
+    // over the states of those pieces only, where a hop may change line only
+    // into a piece one level deeper. Same labels and result as exchangeSearch().
+    int lineGraphSearch(int sourceId, int destId, SearchLabels& labels) {
+        const LineStates& ls = lineStates;
+        const LineGraph& graph = lineGraph;
+        SearchWorkspace& ws = SearchWorkspace::local();
+        vector<int>& fromSource = ws.depth[0];
+        vector<int>& toDest = ws.depth[1];
+        int pieces = graph.pieceLine.size();
+
+        // Pieces are few, so the depths are simply refilled
+        auto bfs = [&](int station, vector<int>& depth) {
+            depth.assign(pieces, INT_MAX);
+            ws.queue.clear();
+            for (int k = ls.offset[station]; k < ls.offset[station + 1]; k++) {
+                int p = graph.statePiece[k];
+                if (depth[p] == INT_MAX) {
+                    depth[p] = 0;
+                    ws.queue.push_back(p);
+                }
             }
-            else if (routeCache.size() >= cacheCapacity) {
-                // Remove least recently used
-                string lruKey = lruList.back();
-                lruList.pop_back();
-                routeCache.erase(lruKey);
+            for (size_t head = 0; head < ws.queue.size(); head++) {
+                int p = ws.queue[head];
+                for (int i = graph.offset[p]; i < graph.offset[p + 1]; i++) {
+                    int q = graph.adjacent[i];
+                    if (depth[q] == INT_MAX) {
+                        depth[q] = depth[p] + 1;
+                        ws.queue.push_back(q);
+                    }
+                }
             }
+        };
+        bfs(sourceId, fromSource);
+        bfs(destId, toDest);
 
-            lruList.push_front(cacheKey);
-            routeCache[cacheKey] = {result, lruList.begin()};
+        int changes = INT_MAX;
+        for (int k = ls.offset[destId]; k < ls.offset[destId + 1]; k++) {
+            changes = min(changes, fromSource[graph.statePiece[k]]);
         }
+        if (changes == INT_MAX) return -1;
 
+        int settled;
+        return search(LineGraphPolicy{{*this}, fromSource, toDest, changes}, sourceId, destId, labels, settled);
+    }
 
-        return result;
+    // Minimum-exchange route between two stations. Returns {changes, metres}
+    // ({INT_MAX, infDistance} when unreachable), the stations of the route and
+    // the line ridden on each hop (hopLines[i] joins route[i] and route[i + 1]).
+    pair<int,int> minimumExchangeRoute(int sourceId, int destId, vector<int>& route, vector<int>& hopLines) {
+        const LineStates& ls = lineStates;
+        route.clear();
+        hopLines.clear();
+
+        if (!patterns.empty()) return patternRoute(sourceId, destId, route, hopLines);
+
+        if (!routingTable.empty()) {
+            // Rows come from a search rooted at destId: a state's line is the one
+            // ridden from its station toward destId
+            size_t row = (size_t)destId * stations.size();
+            size_t stateRow = (size_t)destId * ls.line.size();
+            if (routingTable.changes[row + sourceId] == INT_MAX) return {INT_MAX, infDistance};
+
+            for (int k = routingTable.firstState[row + sourceId]; k != -1; k = routingTable.nextState[stateRow + k]) {
+                route.push_back(ls.station[k]);
+                if (routingTable.nextState[stateRow + k] != -1) hopLines.push_back(ls.line[k]);
+            }
+            return {routingTable.changes[row + sourceId], routingTable.exchangeDist[row + sourceId]};
+        }
+
+        SearchLabels& labels = SearchWorkspace::local().labels[0];
+        int reached = useLineGraph ? lineGraphSearch(sourceId, destId, labels)
+                                   : exchangeSearch(sourceId, destId, labels);
+        if (reached == -1) return {INT_MAX, infDistance};
+
+        walkStates(labels, reached, route, hopLines);
+        return {labels[reached].tag, labels[reached].dist};
     }
 
+    // Stations from the search root to state `reached`, and the line of each hop
+    void walkStates(const SearchLabels& labels, int reached, vector<int>& route, vector<int>& hopLines) {
+        const LineStates& ls = lineStates;
+        route.clear();
+        hopLines.clear();
 
-    json findMinimumExchangesOptimized(const string& source, const string& destination) {
-        string cacheKey = "exchange|" + source + "|" + destination;
-        {
-            lock_guard<mutex> lock(cacheMutex);
+        // Walking back, a state's line is the one used to arrive at it
+        for (int at = reached; at != -1; at = labels[at].parent) {
+            route.push_back(ls.station[at]);
+            if (labels[at].parent != -1) hopLines.push_back(ls.line[at]);
+        }
+        reverse(route.begin(), route.end());
+        reverse(hopLines.begin(), hopLines.end());
+    }
 
-            auto it = routeCache.find(cacheKey);
-            if (it != routeCache.end()) {
-                // Move key to front (most recently used)
-                lruList.erase(it->second.second);
-                lruList.push_front(cacheKey);
-                it->second.second = lruList.begin();
+    // Best route under a line-state policy whose tag counts line changes.
+    // Returns the policy's cost, or infDistance when unreachable.
+    template <typename Policy>
+    int stateRoute(const Policy& policy, int sourceId, int destId, vector<int>& route, vector<int>& hopLines,
+                   int& lineChanges) {
+        SearchLabels& labels = SearchWorkspace::local().labels[0];
+        int settled;
+        int reached = search(policy, sourceId, destId, labels, settled);
+        if (reached == -1) return infDistance;
+
+        walkStates(labels, reached, route, hopLines);
+        lineChanges = labels[reached].tag;
+        return labels[reached].dist;
+    }
 
-                return it->second.first;
+    // Metres along a route, riding the given line on each hop
+    int routeMetres(const vector<int>& route, const vector<int>& hopLines) const {
+        int metres = 0;
+        for (size_t i = 0; i + 1 < route.size(); i++) {
+            int best = infDistance;
+            for (int e = adjOffset[route[i]]; e < adjOffset[route[i] + 1]; e++) {
+                if (edgeTo[e] == route[i + 1] && edgeLine[e] == hopLines[i]) best = min(best, edgeWeight[e]);
             }
+            metres += best;
         }
+        return metres;
+    }
 
+    // Replays the stored pattern from s to t: each leg rides its line along the
+    // shortest stretch between boarding and alighting, read off the line's
+    // distance matrix, so no search runs
+    pair<int,int> patternRoute(int sourceId, int destId, vector<int>& route, vector<int>& hopLines) {
+        const TransferPatterns& tp = patterns;
+        const LineStates& ls = lineStates;
+        route.assign(1, sourceId);
+        if (sourceId == destId) return {0, 0};
+
+        int base = tp.nodeOffset[sourceId];
+        int node = tp.lastLeg[(size_t)sourceId * stations.size() + destId];
+        if (node == TransferPatterns::noLeg) return {INT_MAX, infDistance};
+
+        vector<int>& legs = SearchWorkspace::local().walk;
+        legs.clear();
+        for (; node != -1; node = tp.nodeParent[base + node]) legs.push_back(tp.nodeBoard[base + node]);
+        reverse(legs.begin(), legs.end());
+
+        int metres = 0;
+        for (size_t i = 0; i < legs.size(); i++) {
+            int line = ls.line[legs[i]];
+            int alight = i + 1 < legs.size() ? ls.station[legs[i + 1]] : destId;
+            int size = tp.lineOffset[line + 1] - tp.lineOffset[line];
+            // Matrices are symmetric, so the alighting stop's row holds every stop's distance to it
+            size_t row = tp.matrixOffset[line] + (size_t)tp.stateIndex[stateOf(alight, line)] * size;
+            metres += tp.lineDist[row + tp.stateIndex[legs[i]]];
+
+            // Follow the search tree rooted at the alighting stop
+            for (int at = tp.lineNext[row + tp.stateIndex[legs[i]]]; at != -1; at = tp.lineNext[row + at]) {
+                route.push_back(tp.lineStation[tp.lineOffset[line] + at]);
+                hopLines.push_back(line);
+            }
+        }
+        return {(int)legs.size() - 1, metres};
+    }
 
-
+    json findMinimumExchangesOptimized(string_view source, string_view destination) {
         json result;
 
-        if (!stationToId.count(source) || !stationToId.count(destination)) {
+        int sourceId = stations.find(source);
+        int destId = stations.find(destination);
+
+        if (sourceId == -1 || destId == -1) {
             result["error"] = "Error: One or both stations not found!";
             return result;
         }
 
-        int sourceId = stationToId[source];
-        int destId = stationToId[destination];
+        if (!connected(sourceId, destId)) {
+            result["error"] = "Error: No path found!";
+            return result;
+        }
 
-        struct Node {
-            int station;
-            int lineChanges;
-            double distance;
-            int lineId;
-        };
+        string cacheKey = "exchange|" + to_string(sourceId) + "|" + to_string(destId);
+        if (cacheLookup(cacheKey, result)) return result;
 
-        struct Compare {
-            bool operator()(const Node& a, const Node& b) {
-                if (a.lineChanges == b.lineChanges)
-                    return a.distance > b.distance;
-                return a.lineChanges > b.lineChanges;
-            }
-        };
+        SearchWorkspace& ws = SearchWorkspace::local();
+        vector<int>& route = ws.route;
+        vector<int>& hopLines = ws.hopLines;
+        auto [lineChanges, distance] = minimumExchangeRoute(sourceId, destId, route, hopLines);
 
-        int n = adjInt.size();
-        vector<pair<int,double>> best(n, {INT_MAX, numeric_limits<double>::infinity()});
-        vector<int> parent(n, -1);
+        if (distance == infDistance) {
+            result["error"] = "Error: No path found!";
+            return result;
+        }
 
-        priority_queue<Node, vector<Node>, Compare> pq;
+        describeLineRoute(route, hopLines, result);
+        result["total_line_changes"] = lineChanges;
+        result["total_distance"] = toKm(distance);
 
-        pq.push({sourceId, 0, 0.0, -1});
-        best[sourceId] = {0, 0.0};
+        cacheInsert(cacheKey, result);
+        return result;
+    }
 
-        while (!pq.empty()) {
-            Node current = pq.top();
-            pq.pop();
+    // Metres from every source to every target, row-major at [i * targets + j],
+    // infDistance if apart; with changes, also the minimum line changes, INT_MAX
+    // if apart. The routing table is read directly. Otherwise each target is
+    // dropped into buckets at its meeting points, and each source scans the
+    // buckets of its own meeting points, so one label scan or upward search per
+    // station replaces a search per pair. Without hub labels or a hierarchy,
+    // each source runs one full search. Sources are spread over all cores.
+    void distanceMatrix(const vector<int>& sources, const vector<int>& targets, vector<int>& dist,
+                        vector<int>* changes) {
+        int n = stations.size();
+        size_t m = targets.size();
+        dist.assign(sources.size() * m, infDistance);
+        if (changes) changes->assign(sources.size() * m, INT_MAX);
+        if (dist.empty()) return;
+
+        bool buckets = routingTable.empty() && (!hubLabels.empty() || !hierarchy.empty());
+        vector<int> bucketOffset, bucketTarget, bucketDist;
+        if (buckets) {
+            vector<array<int, 3>> entries;  // meeting point, target index, metres
+            SearchLabels labels;
+            BinaryHeap<uint32_t> pq;
+            for (size_t j = 0; j < m; j++) {
+                forEachMeetingPoint(targets[j], labels, pq, [&](int point, int metres) {
+                    entries.push_back({point, (int)j, metres});
+                });
+            }
 
-            if (current.lineChanges > best[current.station].first ||
-                (current.lineChanges == best[current.station].first &&
-                current.distance > best[current.station].second))
-                continue;
+            bucketOffset.assign(n + 1, 0);
+            for (const auto& entry : entries) bucketOffset[entry[0] + 1]++;
+            for (int u = 0; u < n; u++) bucketOffset[u + 1] += bucketOffset[u];
+            bucketTarget.resize(entries.size());
+            bucketDist.resize(entries.size());
+            vector<int> fill(bucketOffset.begin(), bucketOffset.end() - 1);
+            for (const auto& entry : entries) {
+                int at = fill[entry[0]]++;
+                bucketTarget[at] = entry[1];
+                bucketDist[at] = entry[2];
+            }
+        }
 
-            if (current.station == destId) break;
+        atomic<size_t> nextSource(0);
+        auto worker = [&]() {
+            SearchLabels labels;
+            BinaryHeap<uint32_t> pq;
+            for (size_t i = nextSource++; i < sources.size(); i = nextSource++) {
+                int s = sources[i];
+                int* row = dist.data() + i * m;
+
+                if (!routingTable.empty()) {
+                    for (size_t j = 0; j < m; j++) row[j] = routingTable.dist[(size_t)targets[j] * n + s];
+                } else if (buckets) {
+                    forEachMeetingPoint(s, labels, pq, [&](int point, int metres) {
+                        for (int b = bucketOffset[point]; b < bucketOffset[point + 1]; b++) {
+                            row[bucketTarget[b]] = min(row[bucketTarget[b]], metres + bucketDist[b]);
+                        }
+                    });
+                } else {
+                    dijkstraSearch(s, -1, labels);
+                    for (size_t j = 0; j < m; j++) row[j] = labels.dist(targets[j]);
+                }
 
-            for (auto& edge : adjInt[current.station]) {
+                if (!changes) continue;
+                int* changeRow = changes->data() + i * m;
+                if (!routingTable.empty()) {
+                    for (size_t j = 0; j < m; j++) changeRow[j] = routingTable.changes[(size_t)targets[j] * n + s];
+                } else if (!patterns.empty()) {
+                    for (size_t j = 0; j < m; j++) changeRow[j] = patternChanges(s, targets[j]);
+                } else {
+                    exchangeSearch(s, -1, labels);
+                    for (size_t j = 0; j < m; j++) {
+                        int bestState = bestExchangeState(targets[j], labels);
+                        changeRow[j] = bestState == -1 ? INT_MAX : labels[bestState].tag;
+                    }
+                }
+            }
+        };
 
-                int newLineChanges = current.lineChanges +
-                    ((current.lineId == -1 || current.lineId == edge.lineId) ? 0 : 1);
+        int threads = min<size_t>(max(1u, thread::hardware_concurrency()), sources.size());
+        vector<thread> pool;
+        for (int i = 1; i < threads; i++) pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool) t.join();
+    }
 
-                double newDistance = current.distance + edge.weight;
+    // Line changes on the stored pattern from s to t, INT_MAX if apart
+    int patternChanges(int s, int t) const {
+        const TransferPatterns& tp = patterns;
+        if (s == t) return 0;
 
-                if (newLineChanges < best[edge.to].first ||
-                (newLineChanges == best[edge.to].first &&
-                    newDistance < best[edge.to].second)) {
+        int base = tp.nodeOffset[s];
+        int node = tp.lastLeg[(size_t)s * stations.size() + t];
+        if (node == TransferPatterns::noLeg) return INT_MAX;
 
-                    best[edge.to] = {newLineChanges, newDistance};
-                    parent[edge.to] = current.station;
+        int legs = 0;
+        for (; node != -1; node = tp.nodeParent[base + node]) legs++;
+        return legs - 1;
+    }
 
-                    pq.push({edge.to, newLineChanges, newDistance, edge.lineId});
+    // Flat row-major arrays for /matrix, km and line changes, null where apart
+    json findMatrix(const vector<string>& sourceNames, const vector<string>& targetNames, bool lineChanges) {
+        json result;
+        vector<int> sources, targets;
+        auto resolve = [&](const vector<string>& names, vector<int>& ids) {
+            for (const string& name : names) {
+                int id = stations.find(name);
+                if (id == -1) {
+                    result["error"] = "Error: Station not found: " + name;
+                    return false;
                 }
+                ids.push_back(id);
+            }
+            return true;
+        };
+        if (!resolve(sourceNames, sources) || !resolve(targetNames, targets)) return result;
+
+        vector<int> dist, changes;
+        distanceMatrix(sources, targets, dist, lineChanges ? &changes : nullptr);
+
+        json distances = json::array();
+        for (int metres : dist) {
+            if (metres == infDistance) distances.push_back(nullptr);
+            else distances.push_back(toKm(metres));
+        }
+        result["rows"] = sources.size();
+        result["columns"] = targets.size();
+        result["distances"] = move(distances);
+
+        if (lineChanges) {
+            json counts = json::array();
+            for (int c : changes) {
+                if (c == INT_MAX) counts.push_back(nullptr);
+                else counts.push_back(c);
             }
+            result["line_changes"] = move(counts);
         }
+        return result;
+    }
 
-        if (best[destId].first == INT_MAX) {
-            result["error"] = "Error: No path found!";
+    // Every station within budget of sourceId, cheapest first, as (station,
+    // cost, line changes): metres, or seconds when timed. One search over line
+    // states that ends at the first label over budget. Keys rise with (cost,
+    // changes), so the first state of a station to settle is its best.
+    template <bool timed>
+    void reachable(int sourceId, int budget, vector<array<int, 3>>& reached) {
+        SearchWorkspace& ws = SearchWorkspace::local();
+        SearchLabels& labels = ws.labels[0];
+        SearchLabels& seen = ws.labels[1];  // stations already listed
+        seen.reset(stations.size());
+        reached.clear();
+
+        int settled;
+        search(ReachPolicy<timed>{{*this}}, sourceId, -1, budget, labels, settled, [&](int k) {
+            int u = lineStates.station[k];
+            if (seen.reached(u)) return;
+            seen.set(u, 0, -1);
+            reached.push_back({u, labels[k].dist, labels[k].tag});
+        });
+    }
+
+    // budget is metres, or seconds when timed
+    json findReachableOptimized(string_view source, int budget, bool timed) {
+        json result;
+        int sourceId = stations.find(source);
+
+        if (sourceId == -1) {
+            result["error"] = "Error: Station not found!";
             return result;
         }
 
-        vector<string> path;
-        for (int at = destId; at != -1; at = parent[at]) {
-            path.push_back(idToStation[at]);
+        string cacheKey = string(timed ? "reach_time|" : "reach|") + to_string(sourceId) + "|" + to_string(budget);
+        if (cacheLookup(cacheKey, result)) return result;
+
+        vector<array<int, 3>> reached;
+        if (timed) reachable<true>(sourceId, budget, reached);
+        else reachable<false>(sourceId, budget, reached);
+
+        json list = json::array();
+        for (auto [station, cost, changes] : reached) {
+            json entry = {{"station", stations.name(station)}, {"line_changes", changes}};
+            if (timed) entry["minutes"] = cost / 60.0;
+            else entry["distance"] = toKm(cost);
+            list.push_back(move(entry));
         }
-        reverse(path.begin(), path.end());
+        result["source"] = stations.name(sourceId);
+        result["stations"] = move(list);
+
+        cacheInsert(cacheKey, result);
+        return result;
+    }
 
+    // "path" and "lines" (each line once per ride) of a route over line states
+    void describeLineRoute(const vector<int>& route, const vector<int>& hopLines, json& result) {
+        vector<string_view> path, lines;
+        for (int station : route) {
+            path.push_back(stations.name(station));
+        }
+        for (int line : hopLines) {
+            string_view name = this->lines.name(line);
+            if (lines.empty() || lines.back() != name) lines.push_back(name);
+        }
         result["path"] = path;
-        result["total_line_changes"] = best[destId].first;
-        result["total_distance"] = best[destId].second;
+        result["lines"] = lines;
+    }
 
-        {
-            lock_guard<mutex> lock(cacheMutex);
+    // Travel time or generalised cost routes, over line states like minimum
+    // exchanges. Distance and exchanges go to their own endpoints' code.
+    json findRouteOptimized(string_view source, string_view destination, RouteMode mode) {
+        if (mode == ModeDistance) return findShortestPathOptimized(source, destination, engineFromName(shortestPathEngine));
+        if (mode == ModeExchanges) return findMinimumExchangesOptimized(source, destination);
 
-            // If already exists (rare but safe)
-            if (routeCache.count(cacheKey)) {
-                lruList.erase(routeCache[cacheKey].second);
-            }
-            else if (routeCache.size() >= cacheCapacity) {
-                // Remove least recently used
-                string lruKey = lruList.back();
-                lruList.pop_back();
-                routeCache.erase(lruKey);
-            }
+        json result;
+        int sourceId = stations.find(source);
+        int destId = stations.find(destination);
+
+        if (sourceId == -1 || destId == -1) {
+            result["error"] = "Error: One or both stations not found!";
+            return result;
+        }
+
+        if (!connected(sourceId, destId)) {
+            result["error"] = "Error: No path found!";
+            return result;
+        }
+
+        string cacheKey = string(modeNames[mode]) + "|" + to_string(sourceId) + "|" + to_string(destId);
+        if (cacheLookup(cacheKey, result)) return result;
 
-            lruList.push_front(cacheKey);
-            routeCache[cacheKey] = {result, lruList.begin()};
+        SearchWorkspace& ws = SearchWorkspace::local();
+        int lineChanges;
+        int cost = mode == ModeTime ? stateRoute(TimePolicy{{*this}}, sourceId, destId, ws.route, ws.hopLines, lineChanges)
+                                    : stateRoute(GeneralisedCostPolicy{{*this}}, sourceId, destId, ws.route, ws.hopLines, lineChanges);
+
+        if (cost == infDistance) {
+            result["error"] = "Error: No path found!";
+            return result;
         }
 
+        describeLineRoute(ws.route, ws.hopLines, result);
+        result["total_line_changes"] = lineChanges;
+        result["total_distance"] = toKm(routeMetres(ws.route, ws.hopLines));
+        if (mode == ModeTime) result["total_time_minutes"] = cost / 60.0;
+        else result["generalised_cost"] = toKm(cost);
+
+        cacheInsert(cacheKey, result);
         return result;
     }
 
 };
 
-int main() {
-    MetroGraph metro;
-    metro.loadFromFile("public/dataset/Delhi_Metro_Lines.csv");
-    metro.buildIntegerGraph();
+// Benchmarks include this file for MetroGraph and define METRO_NO_MAIN
+#ifndef METRO_NO_MAIN
+int main(int argc, char* argv[]) {
+    string datasetPath = "public/dataset/Delhi_Metro_Lines.csv";
+    string coordinatesPath = "public/dataset/metro_coordinates.csv";
+    string snapshotPath, compileSnapshotPath;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--dataset" && i + 1 < argc) {
+            datasetPath = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        } else if (arg == "--compile-snapshot" && i + 1 < argc) {
+            compileSnapshotPath = argv[++i];
+        } else if (arg == "--coordinates" && i + 1 < argc) {
+            coordinatesPath = argv[++i];
+        } else if (arg == "--engine" && i + 1 < argc) {
+            shortestPathEngine = argv[++i];
+        } else {
+            cout << "Usage: " << argv[0] << " [--dataset file.csv] [--coordinates file.csv] [--snapshot file.bin]"
+                 << " [--compile-snapshot out.bin] [--engine auto|table|overlay|dijkstra|bidirectional|astar|ch|hub|alt|tree]" << endl;
+            return 1;
+        }
+    }
+
+    if (engineFromName(shortestPathEngine) == EngineCount) {
+        cout << "Unknown engine: " << shortestPathEngine << endl;
+        return 1;
+    }
+
+    if (!compileSnapshotPath.empty()) {
+        MetroGraph metro;
+        if (!metro.loadFromFile(datasetPath)) return 1;
+        metro.buildIntegerGraph();
+        if (!metro.saveSnapshot(compileSnapshotPath)) return 1;
+        cout << "Snapshot written to " << compileSnapshotPath << endl;
+        return 0;
+    }
+
+    // Null if neither the snapshot nor the dataset gives a graph with stations
+    auto loadGraph = [&]() -> shared_ptr<MetroGraph> {
+        auto graph = make_shared<MetroGraph>();
+        if (snapshotPath.empty() || !graph->loadSnapshot(snapshotPath)) {
+            if (!graph->loadFromFile(datasetPath)) return nullptr;
+            graph->buildIntegerGraph();
+        }
+        graph->loadCoordinates(coordinatesPath);
+        return graph;
+    };
+
+    // Requests take their own reference, so a reload never pulls a graph from under them
+    shared_ptr<MetroGraph> current = loadGraph();
+    if (!current) {
+        current = make_shared<MetroGraph>();
+        current->buildIntegerGraph();
+    }
+    auto graph = [&]() { return atomic_load(&current); };
+
+    // A snapshot must be replaced by renaming a complete file over it, as
+    // saveSnapshot() does: the current graph still reads the old file's pages
+    // through its mapping, and rewriting that file in place faults them.
+    if (datasetPollSeconds > 0) {
+        string watched = snapshotPath.empty() ? datasetPath : snapshotPath;
+        thread([&, watched]() {
+            error_code ec;
+            auto seen = filesystem::last_write_time(watched, ec);
+            while (true) {
+                this_thread::sleep_for(chrono::seconds(datasetPollSeconds));
+                auto modified = filesystem::last_write_time(watched, ec);
+                if (ec || modified == seen) continue;
+
+                seen = modified;
+                cout << "Dataset changed, rebuilding graph from " << watched << endl;
+                shared_ptr<MetroGraph> rebuilt = loadGraph();
+                if (rebuilt) {
+                    atomic_store(&current, rebuilt);
+                } else {
+                    cout << "Reload failed, keeping the current graph" << endl;
+                }
+            }
+        }).detach();
+    }
 
     httplib::Server svr;
     svr.set_mount_point("/", "./public");
 
 
     svr.Get("/shortest_path", [&](const httplib::Request& req, httplib::Response& res) {
-        if (req.has_param("source") && req.has_param("destination")) {
-            string source = req.get_param_value("source");
-            string destination = req.get_param_value("destination");
-            json result = metro.findShortestPathOptimized(source, destination);
+        // Names are looked up straight from the parsed parameters, without copies
+        auto source = req.params.find("source");
+        auto destination = req.params.find("destination");
+        auto engineParam = req.params.find("engine");
+        ShortestPathEngine engine = engineFromName(engineParam != req.params.end() ? engineParam->second : shortestPathEngine);
+        if (engine == EngineCount) {
+            res.status = 400;
+            res.set_content("Unknown engine", "text/plain");
+        } else if (source != req.params.end() && destination != req.params.end()) {
+            json result = graph()->findShortestPathOptimized(source->second, destination->second, engine);
             res.set_header("Access-Control-Allow-Origin", "*");
             res.set_content(result.dump(4), "application/json");
         } else {
@@ -367,10 +3545,11 @@ int main() {
     });
 
     svr.Get("/min_exchanges", [&](const httplib::Request& req, httplib::Response& res) {
-        if (req.has_param("source") && req.has_param("destination")) {
-            string source = req.get_param_value("source");
-            string destination = req.get_param_value("destination");
-            json result = metro.findMinimumExchangesOptimized(source, destination);
+        // Names are looked up straight from the parsed parameters, without copies
+        auto source = req.params.find("source");
+        auto destination = req.params.find("destination");
+        if (source != req.params.end() && destination != req.params.end()) {
+            json result = graph()->findMinimumExchangesOptimized(source->second, destination->second);
             res.set_header("Access-Control-Allow-Origin", "*");
             res.set_content(result.dump(4), "application/json");
         } else {
@@ -379,8 +3558,88 @@ int main() {
         }
     });
 
+    svr.Get("/route", [&](const httplib::Request& req, httplib::Response& res) {
+        auto source = req.params.find("source");
+        auto destination = req.params.find("destination");
+        auto modeParam = req.params.find("mode");
+        RouteMode mode = modeParam != req.params.end() ? modeFromName(modeParam->second) : ModeDistance;
+        if (mode == ModeCount) {
+            res.status = 400;
+            res.set_content("Unknown mode", "text/plain");
+        } else if (source != req.params.end() && destination != req.params.end()) {
+            json result = graph()->findRouteOptimized(source->second, destination->second, mode);
+            res.set_header("Access-Control-Allow-Origin", "*");
+            res.set_content(result.dump(4), "application/json");
+        } else {
+            res.status = 400;
+            res.set_content("Missing parameters", "text/plain");
+        }
+    });
+
+    // Body: {"sources": [names], "targets": [names], "line_changes": bool}
+    svr.Post("/matrix", [&](const httplib::Request& req, httplib::Response& res) {
+        json body = json::parse(req.body, nullptr, false);
+        vector<string> sources, targets;
+        bool lineChanges = false;
+        bool valid = body.is_object() && body.contains("sources") && body.contains("targets");
+        try {
+            if (valid) {
+                sources = body["sources"].get<vector<string>>();
+                targets = body["targets"].get<vector<string>>();
+                lineChanges = body.value("line_changes", false);
+            }
+        } catch (const json::exception&) {
+            valid = false;
+        }
+
+        if (!valid) {
+            res.status = 400;
+            res.set_content("Missing parameters", "text/plain");
+        } else if (sources.size() * targets.size() > matrixMaxCells) {
+            res.status = 400;
+            res.set_content("Matrix too large", "text/plain");
+        } else {
+            json result = graph()->findMatrix(sources, targets, lineChanges);
+            res.set_header("Access-Control-Allow-Origin", "*");
+            // No indentation: the arrays can run to many thousands of entries
+            res.set_content(result.dump(), "application/json");
+        }
+    });
+
+    svr.Get("/reachable", [&](const httplib::Request& req, httplib::Response& res) {
+        auto source = req.params.find("source");
+        auto maxKm = req.params.find("max_km");
+        auto maxMinutes = req.params.find("max_minutes");
+        bool timed = maxKm == req.params.end();
+        auto limit = timed ? maxMinutes : maxKm;
+
+        double amount = -1;
+        if (limit != req.params.end()) {
+            const string& text = limit->second;
+            from_chars(text.data(), text.data() + text.size(), amount);
+        }
+
+        if (source == req.params.end() || !(amount >= 0)) {
+            res.status = 400;
+            res.set_content("Missing parameters", "text/plain");
+        } else {
+            // Seconds or metres, capped so that any budget fits an int
+            double units = timed ? amount * 60 : amount * metresPerKm;
+            int budget = units >= infDistance ? infDistance : (int)lround(units);
+            json result = graph()->findReachableOptimized(source->second, budget, timed);
+            res.set_header("Access-Control-Allow-Origin", "*");
+            res.set_content(result.dump(4), "application/json");
+        }
+    });
+
+    svr.Get("/health", [&](const httplib::Request&, httplib::Response& res) {
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_content(graph()->healthReport().dump(4), "application/json");
+    });
+
     cout << "Server listening on http://localhost:8080" << endl;
     svr.listen("0.0.0.0", 8080);
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file